@@ -0,0 +1,225 @@
+#include "vk_engine/vk_engine.hpp"
+
+#include <SDL.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// A scripted scene: count renderables, drawn as instances or one by one
+struct Scene
+{
+  std::string name;
+  uint32_t count;
+  bool batched;
+  // Alternate the material of consecutive renderables
+  bool switch_pipelines;
+};
+
+struct Result
+{
+  std::string scene;
+  uint32_t count{0};
+  uint32_t frames{0};
+  double fps{0.0};
+  double cpu_avg_ms{0.0};
+  double cpu_p50_ms{0.0};
+  double cpu_p95_ms{0.0};
+  double cpu_p99_ms{0.0};
+  double fence_wait_avg_ms{0.0};
+  double acquire_avg_ms{0.0};
+};
+
+double percentile(std::vector<double> const& sorted, double p)
+{
+  auto index = static_cast<std::size_t>(p * (sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+void populate(VulkanEngine& engine, Scene const& scene)
+{
+  engine.clear_renderables();
+  auto* mesh     = engine.get_mesh("triangle");
+  auto* material = engine.get_material("default");
+  auto* red      = engine.get_material("red");
+  // Spread the triangles, or the model given with --mesh, over a square grid
+  // covering the viewport
+  uint32_t side = 1;
+  while (side * side < scene.count) {
+    ++side;
+  }
+  const float cell = 2.f / side;
+  glm::mat4 cell_transform{1.f};
+  cell_transform[0][0] = cell * 0.4f;
+  cell_transform[1][1] = cell * 0.4f;
+  cell_transform[2][2] = cell * 0.4f;
+  if (auto* model = engine.get_mesh("model")) {
+    mesh           = model;
+    cell_transform = mesh->fit_transform(cell * 0.4f);
+  }
+  for (uint32_t i = 0; i < scene.count; ++i) {
+    glm::mat4 transform = cell_transform;
+    transform[3] += glm::vec4{-1.f + cell * (i % side + 0.5f),
+                              -1.f + cell * (i / side + 0.5f), 0.f, 0.f};
+    auto* object_material =
+        scene.switch_pipelines && i % 2 == 1 ? red : material;
+    engine.add_renderable(
+        {mesh, object_material, transform, glm::vec4{1.f}});
+  }
+}
+
+// A window left without its events drained is reported as not responding,
+// the swapchain recreation after a resize is left to draw(). The run is
+// scripted, so closing the window is ignored
+void pump_events(EngineConfig const& config)
+{
+  if (config.headless) {
+    return;
+  }
+  SDL_Event e;
+  while (SDL_PollEvent(&e) != 0) {
+  }
+}
+
+Result run_scene(Scene const& scene, EngineConfig config, uint32_t warmup)
+{
+  config.batch_draws   = scene.batched;
+  config.max_instances = std::max(config.max_instances, scene.count);
+
+  VulkanEngine engine;
+  engine.init(config);
+  engine.select_shader(2);
+  populate(engine, scene);
+
+  for (uint32_t i = 0; i < warmup; ++i) {
+    pump_events(config);
+    engine.draw();
+  }
+
+  using Milliseconds = std::chrono::duration<double, std::milli>;
+  std::vector<double> frame_times;
+  frame_times.reserve(config.frame_count);
+  double fence_wait_ms = 0.0;
+  double acquire_ms    = 0.0;
+  auto start           = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < config.frame_count; ++i) {
+    pump_events(config);
+    auto frame_start = std::chrono::steady_clock::now();
+    engine.draw();
+    frame_times.push_back(
+        Milliseconds{std::chrono::steady_clock::now() - frame_start}.count());
+    fence_wait_ms += engine.last_frame_stats().fence_wait_ms;
+    acquire_ms += engine.last_frame_stats().acquire_ms;
+  }
+  const double elapsed_ms =
+      Milliseconds{std::chrono::steady_clock::now() - start}.count();
+  engine.cleanup();
+
+  Result result{scene.name, scene.count, config.frame_count};
+  std::sort(frame_times.begin(), frame_times.end());
+  result.fps        = config.frame_count / (elapsed_ms / 1000.0);
+  result.cpu_avg_ms = elapsed_ms / config.frame_count;
+  result.cpu_p50_ms = percentile(frame_times, 0.50);
+  result.cpu_p95_ms = percentile(frame_times, 0.95);
+  result.cpu_p99_ms = percentile(frame_times, 0.99);
+  result.fence_wait_avg_ms = fence_wait_ms / config.frame_count;
+  result.acquire_avg_ms    = acquire_ms / config.frame_count;
+  return result;
+}
+
+void write_json(std::ostream& out, std::vector<Result> const& results)
+{
+  out << "{\n  \"results\": [";
+  for (std::size_t i = 0; i < results.size(); ++i) {
+    auto const& r = results[i];
+    out << (i == 0 ? "\n" : ",\n") << "    {\"scene\": \"" << r.scene
+        << "\", \"count\": " << r.count << ", \"frames\": " << r.frames
+        << ", \"fps\": " << r.fps << ", \"cpu_avg_ms\": " << r.cpu_avg_ms
+        << ", \"cpu_p50_ms\": " << r.cpu_p50_ms
+        << ", \"cpu_p95_ms\": " << r.cpu_p95_ms
+        << ", \"cpu_p99_ms\": " << r.cpu_p99_ms
+        << ", \"fence_wait_avg_ms\": " << r.fence_wait_avg_ms
+        << ", \"acquire_avg_ms\": " << r.acquire_avg_ms << '}';
+  }
+  out << "\n  ]\n}\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  EngineConfig config;
+  config.headless    = true;
+  config.frame_count = 500;
+  // Every run starts from the same, empty, pipeline cache state
+  config.pipeline_cache_path.clear();
+  uint32_t count      = 10'000;
+  uint32_t warmup     = 50;
+  char const* output  = nullptr;
+  std::string_view only;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--window") {
+      config.headless = false;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      config.frame_count = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      warmup = std::atoi(argv[++i]);
+    } else if (arg == "--count" && i + 1 < argc) {
+      count = std::max(std::atoi(argv[++i]), 1);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      config.parallel_recording = true;
+      config.recording_threads  = std::atoi(argv[++i]);
+    } else if (arg == "--gpu-culling") {
+      config.gpu_culling = true;
+    } else if (arg == "--render-passes") {
+      config.dynamic_rendering = false;
+    } else if (arg == "--mesh" && i + 1 < argc) {
+      config.mesh_path = argv[++i];
+    } else if (arg == "--scene" && i + 1 < argc) {
+      only = argv[++i];
+    } else if (arg == "--output" && i + 1 < argc) {
+      output = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--window] [--frames N] [--warmup N] [--count N]"
+                   " [--threads N] [--gpu-culling] [--render-passes]"
+                   " [--mesh file.vmesh] [--scene name]"
+                   " [--output file.json]\n";
+      return 1;
+    }
+  }
+
+  const std::vector<Scene> scenes{
+      {"instanced_triangles", count, true, false},
+      {"draws", count, false, false},
+      {"pipeline_switches", count, false, true},
+  };
+  std::vector<Result> results;
+  for (auto const& scene : scenes) {
+    if (!only.empty() && scene.name != only) {
+      continue;
+    }
+    std::cerr << "running " << scene.name << " (" << scene.count << ")\n";
+    results.push_back(run_scene(scene, config, warmup));
+  }
+
+  if (output == nullptr) {
+    write_json(std::cout, results);
+    return 0;
+  }
+  std::ofstream file{output};
+  if (!file.is_open()) {
+    std::cerr << "failed to open " << output << '\n';
+    return 1;
+  }
+  write_json(file, results);
+  return file.good() ? 0 : 1;
+}
@@ -1,10 +1,72 @@
 #include "vk_engine/vk_engine.hpp"
 
-int main()
+#include <cstdlib>
+#include <iostream>
+#include <string_view>
+
+int main(int argc, char* argv[])
 {
+  EngineConfig config;
+  char const* dump_path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--headless") {
+      config.headless = true;
+    } else if (arg == "--frames" && i + 1 < argc) {
+      config.frame_count = std::atoi(argv[++i]);
+    } else if (arg == "--low-latency") {
+      config.low_latency = true;
+    } else if (arg == "--queued-frames" && i + 1 < argc) {
+      config.max_queued_frames = std::atoi(argv[++i]);
+    } else if (arg == "--threads" && i + 1 < argc) {
+      // Record the draws on N worker threads, 0 for one per core
+      config.parallel_recording = true;
+      config.recording_threads  = std::atoi(argv[++i]);
+    } else if (arg == "--particles" && i + 1 < argc) {
+      config.particle_count = std::atoi(argv[++i]);
+    } else if (arg == "--gpu-culling") {
+      config.gpu_culling = true;
+    } else if (arg == "--render-passes") {
+      config.dynamic_rendering = false;
+    } else if (arg == "--mesh" && i + 1 < argc) {
+      config.mesh_path = argv[++i];
+    } else if (arg == "--capture" && i + 1 < argc) {
+      config.capture_directory = argv[++i];
+    } else if (arg == "--capture-format" && i + 1 < argc) {
+      std::string_view format{argv[++i]};
+      config.capture_format = format == "png"   ? CaptureFormat::png
+                              : format == "raw" ? CaptureFormat::raw
+                                                : CaptureFormat::ppm;
+    } else if (arg == "--capture-interval" && i + 1 < argc) {
+      config.capture_interval = std::atoi(argv[++i]);
+    } else if (arg == "--gpu-profile" && i + 1 < argc) {
+      config.gpu_profile_path = argv[++i];
+    } else if (arg == "--trace" && i + 1 < argc) {
+      config.trace_path = argv[++i];
+    } else if (arg == "--dump" && i + 1 < argc) {
+      dump_path = argv[++i];
+    } else {
+      std::cerr << "usage: " << argv[0]
+                << " [--headless] [--frames N] [--low-latency]"
+                   " [--queued-frames N] [--threads N] [--particles N]"
+                   " [--gpu-culling] [--render-passes] [--mesh file.vmesh]"
+                   " [--capture dir] [--capture-format ppm|png|raw]"
+                   " [--capture-interval N]"
+                   " [--gpu-profile file.{csv,json}] [--trace file.json]"
+                   " [--dump file.ppm]\n";
+      return 1;
+    }
+  }
+  if (config.headless && config.frame_count == 0) {
+    config.frame_count = 1000;
+  }
+
   VulkanEngine engine;
-  engine.init();
+  engine.init(config);
   engine.run();
+  if (dump_path != nullptr) {
+    engine.save_frame(dump_path);
+  }
   engine.cleanup();
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,61 @@
+#version 450
+
+layout (local_size_x = 256) in;
+
+struct ObjectBounds
+{
+  // Bounding sphere in world space, center in xyz and radius in w
+  vec4 sphere;
+  uint draw_index;
+};
+
+// VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+  uint index_count;
+  uint instance_count;
+  uint first_index;
+  int vertex_offset;
+  uint first_instance;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer BoundsBuffer
+{
+  ObjectBounds objects[];
+};
+
+// instance_count is zero on entry, each draw owns the instance ids from
+// first_instance on
+layout (std430, set = 0, binding = 1) buffer DrawBuffer
+{
+  DrawCommand draws[];
+};
+
+layout (std430, set = 0, binding = 2) writeonly buffer VisibleBuffer
+{
+  uint visible_ids[];
+};
+
+layout (push_constant) uniform Constants
+{
+  // Frustum planes, normalized and pointing inwards
+  vec4 planes[6];
+  uint object_count;
+};
+
+void main()
+{
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= object_count) {
+    return;
+  }
+  ObjectBounds object = objects[index];
+  for (int i = 0; i < 6; ++i) {
+    if (dot(planes[i].xyz, object.sphere.xyz) + planes[i].w
+        < -object.sphere.w) {
+      return;
+    }
+  }
+  uint slot = atomicAdd(draws[object.draw_index].instance_count, 1);
+  visible_ids[draws[object.draw_index].first_instance + slot] = index;
+}
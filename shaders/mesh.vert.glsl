@@ -0,0 +1,40 @@
+#version 450
+
+layout (location = 0) in vec3 in_position;
+layout (location = 1) in vec3 in_normal;
+layout (location = 2) in vec3 in_color;
+
+layout (location = 0) out vec3 out_color;
+
+struct InstanceData
+{
+  mat4 model;
+  vec4 color;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer InstanceBuffer
+{
+  InstanceData instances[];
+};
+
+// Instance ids in draw order, compacted by cull.comp.glsl when culling on the
+// GPU
+layout (std430, set = 0, binding = 1) readonly buffer VisibleBuffer
+{
+  uint visible_ids[];
+};
+
+layout (std140, set = 1, binding = 0) uniform FrameBuffer
+{
+  mat4 view_projection;
+  // Seconds since init in x, the clear color flash in y
+  vec4 time;
+} frame;
+
+void main()
+{
+  InstanceData instance = instances[visible_ids[gl_InstanceIndex]];
+  gl_Position = frame.view_projection * instance.model
+              * vec4(in_position, 1.0f);
+  out_color = in_color * instance.color.rgb;
+}
@@ -0,0 +1,51 @@
+#version 450
+
+layout (local_size_x = 256) in;
+
+struct Particle
+{
+  vec2 position;
+  vec2 velocity;
+  vec4 color;
+};
+
+// State of the previous frame, and the one being written for this frame
+layout (std430, set = 0, binding = 0) readonly buffer ParticlesIn
+{
+  Particle particles_in[];
+};
+
+layout (std430, set = 0, binding = 1) writeonly buffer ParticlesOut
+{
+  Particle particles_out[];
+};
+
+layout (push_constant) uniform Constants
+{
+  float delta_time;
+  uint particle_count;
+};
+
+// Clip space y points down
+const float gravity = 1.5f;
+
+void main()
+{
+  uint index = gl_GlobalInvocationID.x;
+  if (index >= particle_count) {
+    return;
+  }
+  Particle particle = particles_in[index];
+  particle.velocity.y += gravity * delta_time;
+  particle.position += particle.velocity * delta_time;
+  // Bounce off the edges of the screen
+  if (abs(particle.position.x) > 1.0f) {
+    particle.position.x = clamp(particle.position.x, -1.0f, 1.0f);
+    particle.velocity.x = -particle.velocity.x;
+  }
+  if (abs(particle.position.y) > 1.0f) {
+    particle.position.y = clamp(particle.position.y, -1.0f, 1.0f);
+    particle.velocity.y = -particle.velocity.y;
+  }
+  particles_out[index] = particle;
+}
@@ -0,0 +1,24 @@
+#version 450
+
+layout (location = 0) out vec3 out_color;
+
+struct Particle
+{
+  vec2 position;
+  vec2 velocity;
+  vec4 color;
+};
+
+layout (std430, set = 0, binding = 0) readonly buffer Particles
+{
+  Particle particles[];
+};
+
+void main()
+{
+  Particle particle = particles[gl_VertexIndex];
+  gl_Position = vec4(particle.position, 0.0f, 1.0f);
+  // Larger points need the largePoints feature
+  gl_PointSize = 1.0f;
+  out_color = particle.color.rgb;
+}
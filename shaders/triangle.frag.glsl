@@ -1,8 +1,18 @@
 #version 450
 
+// 0: interpolated vertex color, 1: SOLID_COLOR
+layout (constant_id = 0) const uint COLOR_MODE = 0;
+layout (constant_id = 1) const float SOLID_COLOR_R = 1.0f;
+layout (constant_id = 2) const float SOLID_COLOR_G = 1.0f;
+layout (constant_id = 3) const float SOLID_COLOR_B = 1.0f;
+
 layout (location = 0) in vec3 in_color;
 layout (location = 0) out vec4 out_frag_color;
 
 void main() {
-  out_frag_color = vec4(in_color, 1.0f);
-}
\ No newline at end of file
+  if (COLOR_MODE == 1) {
+    out_frag_color = vec4(SOLID_COLOR_R, SOLID_COLOR_G, SOLID_COLOR_B, 1.0f);
+  } else {
+    out_frag_color = vec4(in_color, 1.0f);
+  }
+}
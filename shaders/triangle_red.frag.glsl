@@ -1,7 +0,0 @@
-#version 450
-
-layout (location = 0) out vec4 out_frag_color;
-
-void main() {
-  out_frag_color = vec4(1.0f, 0.0f, 0.0f, 1.0f);
-}
\ No newline at end of file
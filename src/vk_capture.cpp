@@ -0,0 +1,321 @@
+#include "vk_capture.hpp"
+
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace {
+
+std::array<uint32_t, 256> make_crc_table()
+{
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = crc & 1 ? 0xedb88320u ^ (crc >> 1) : crc >> 1;
+    }
+    table[i] = crc;
+  }
+  return table;
+}
+
+uint32_t crc32(uint32_t crc, uint8_t const* data, std::size_t size)
+{
+  static const auto table = make_crc_table();
+  crc                     = ~crc;
+  for (std::size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void push_u32_be(std::vector<uint8_t>& out, uint32_t value)
+{
+  out.push_back(static_cast<uint8_t>(value >> 24));
+  out.push_back(static_cast<uint8_t>(value >> 16));
+  out.push_back(static_cast<uint8_t>(value >> 8));
+  out.push_back(static_cast<uint8_t>(value));
+}
+
+void push_chunk(std::vector<uint8_t>& out, char const* type,
+                std::vector<uint8_t> const& data)
+{
+  push_u32_be(out, static_cast<uint32_t>(data.size()));
+  const auto start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data.begin(), data.end());
+  push_u32_be(out, crc32(0, out.data() + start, out.size() - start));
+}
+
+// RGB8 rows, each preceded by its filter byte, in a zlib stream of stored
+// blocks
+std::vector<uint8_t> encode_png(std::vector<uint8_t> const& rgb,
+                                VkExtent2D extent)
+{
+  std::vector<uint8_t> scanlines;
+  const std::size_t row_size = std::size_t{extent.width} * 3;
+  scanlines.reserve((row_size + 1) * extent.height);
+  for (uint32_t y = 0; y < extent.height; ++y) {
+    scanlines.push_back(0);
+    scanlines.insert(scanlines.end(), rgb.begin() + y * row_size,
+                     rgb.begin() + (y + 1) * row_size);
+  }
+
+  std::vector<uint8_t> zlib{0x78, 0x01};
+  zlib.reserve(scanlines.size() + scanlines.size() / 65535 * 5 + 16);
+  uint32_t adler_a = 1, adler_b = 0;
+  std::size_t offset = 0;
+  do {
+    const auto size =
+        static_cast<uint16_t>(std::min<std::size_t>(scanlines.size() - offset,
+                                                    65535));
+    const bool last = offset + size == scanlines.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(static_cast<uint8_t>(size));
+    zlib.push_back(static_cast<uint8_t>(size >> 8));
+    zlib.push_back(static_cast<uint8_t>(~size));
+    zlib.push_back(static_cast<uint8_t>(~size >> 8));
+    for (std::size_t i = offset; i < offset + size; ++i) {
+      adler_a = (adler_a + scanlines[i]) % 65521;
+      adler_b = (adler_b + adler_a) % 65521;
+    }
+    zlib.insert(zlib.end(), scanlines.begin() + offset,
+                scanlines.begin() + offset + size);
+    offset += size;
+  } while (offset < scanlines.size());
+  push_u32_be(zlib, (adler_b << 16) | adler_a);
+
+  std::vector<uint8_t> header;
+  push_u32_be(header, extent.width);
+  push_u32_be(header, extent.height);
+  // 8-bit RGB, deflate, adaptive filtering, no interlacing
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+
+  std::vector<uint8_t> png{0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  push_chunk(png, "IHDR", header);
+  push_chunk(png, "IDAT", zlib);
+  push_chunk(png, "IEND", {});
+  return png;
+}
+
+} // namespace
+
+void FrameCapture::init(DeviceAllocator& allocator,
+                        std::filesystem::path directory, CaptureFormat format,
+                        VkExtent2D extent, uint32_t slot_count)
+{
+  m_allocator = &allocator;
+  m_directory = std::move(directory);
+  m_format    = format;
+  std::error_code error;
+  std::filesystem::create_directories(m_directory, error);
+  if (error) {
+    std::cerr << "cannot create " << m_directory << ": " << error.message()
+              << '\n';
+  }
+  // Read on the CPU only, cached memory makes the encoding much faster
+  m_slots = std::vector<Slot>(slot_count);
+  for (auto& slot : m_slots) {
+    slot.buffer = m_allocator->create_buffer(
+        VkDeviceSize{extent.width} * extent.height * 4,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  }
+  m_next_slot = 0;
+  m_written   = 0;
+  m_dropped   = 0;
+  m_stopping  = false;
+  m_writer    = std::thread{&FrameCapture::writer_loop, this};
+}
+
+void FrameCapture::destroy()
+{
+  collect(UINT64_MAX);
+  {
+    std::lock_guard lock{m_mutex};
+    m_stopping = true;
+  }
+  m_work_available.notify_one();
+  m_writer.join();
+  for (auto& slot : m_slots) {
+    m_allocator->destroy_buffer(slot.buffer);
+  }
+  m_slots.clear();
+}
+
+bool FrameCapture::supports(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool FrameCapture::record(VkCommandBuffer cmd, VkImage image,
+                          VkExtent2D extent, VkFormat format, uint64_t frame)
+{
+  auto& slot = m_slots[m_next_slot];
+  {
+    std::lock_guard lock{m_mutex};
+    if (slot.state != SlotState::free) {
+      // The slots are used in order, the next one is the oldest
+      ++m_dropped;
+      return false;
+    }
+  }
+  const VkDeviceSize size = VkDeviceSize{extent.width} * extent.height * 4;
+  if (slot.buffer.size < size) {
+    // Neither the GPU nor the writer uses a free slot
+    m_allocator->destroy_buffer(slot.buffer);
+    slot.buffer = m_allocator->create_buffer(
+        size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+  }
+  slot.state  = SlotState::copying;
+  slot.frame  = frame;
+  slot.extent = extent;
+  slot.bgra   = format == VK_FORMAT_B8G8R8A8_UNORM
+              || format == VK_FORMAT_B8G8R8A8_SRGB;
+  m_next_slot = (m_next_slot + 1) % m_slots.size();
+
+  VkBufferImageCopy region{};
+  region.bufferOffset      = 0;
+  region.bufferRowLength   = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource  = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageOffset       = {0, 0, 0};
+  region.imageExtent       = {extent.width, extent.height, 1};
+  vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                         slot.buffer.buffer, 1, &region);
+  // The fence waited on before collect() makes the copy visible to the
+  // host, provided the host reads are ordered after the transfer writes
+  VkMemoryBarrier barrier{};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext         = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &barrier, 0, nullptr,
+                       0, nullptr);
+  return true;
+}
+
+void FrameCapture::collect(uint64_t completed_frames)
+{
+  bool queued = false;
+  {
+    std::lock_guard lock{m_mutex};
+    // In capture order, so the files are written in frame order
+    for (uint32_t i = 0; i < m_slots.size(); ++i) {
+      const auto index = static_cast<uint32_t>((m_next_slot + i)
+                                               % m_slots.size());
+      auto& slot = m_slots[index];
+      if (slot.state == SlotState::copying && slot.frame < completed_frames) {
+        slot.state = SlotState::writing;
+        m_queue.push(index);
+        queued = true;
+      }
+    }
+  }
+  if (queued) {
+    m_work_available.notify_one();
+  }
+}
+
+uint32_t FrameCapture::written_frames()
+{
+  std::lock_guard lock{m_mutex};
+  return m_written;
+}
+
+uint32_t FrameCapture::dropped_frames() const
+{
+  return m_dropped;
+}
+
+void FrameCapture::writer_loop()
+{
+  while (true) {
+    uint32_t index;
+    {
+      std::unique_lock lock{m_mutex};
+      m_work_available.wait(lock,
+                            [this] { return m_stopping || !m_queue.empty(); });
+      if (m_queue.empty()) {
+        return;
+      }
+      index = m_queue.front();
+      m_queue.pop();
+    }
+    // The render thread leaves the slot alone until it is free again
+    const bool written = write(m_slots[index]);
+    std::lock_guard lock{m_mutex};
+    m_slots[index].state = SlotState::free;
+    m_written += written ? 1 : 0;
+  }
+}
+
+bool FrameCapture::write(Slot const& slot)
+{
+  const auto width  = slot.extent.width;
+  const auto height = slot.extent.height;
+  auto const* pixels =
+      reinterpret_cast<uint8_t const*>(slot.buffer.allocation.mapped);
+  const std::size_t pixel_count = std::size_t{width} * height;
+
+  char name[64];
+  std::snprintf(name, sizeof(name), "frame_%06llu",
+                static_cast<unsigned long long>(slot.frame));
+  std::filesystem::path file_path = m_directory / name;
+  std::vector<uint8_t> data;
+  if (m_format == CaptureFormat::raw) {
+    file_path += "_" + std::to_string(width) + "x" + std::to_string(height)
+               + ".raw";
+    data.assign(pixels, pixels + pixel_count * 4);
+    if (slot.bgra) {
+      for (std::size_t i = 0; i < data.size(); i += 4) {
+        std::swap(data[i], data[i + 2]);
+      }
+    }
+  } else {
+    // Both drop the alpha channel
+    const int red  = slot.bgra ? 2 : 0;
+    const int blue = slot.bgra ? 0 : 2;
+    std::vector<uint8_t> rgb(pixel_count * 3);
+    for (std::size_t i = 0; i < pixel_count; ++i) {
+      rgb[i * 3]     = pixels[i * 4 + red];
+      rgb[i * 3 + 1] = pixels[i * 4 + 1];
+      rgb[i * 3 + 2] = pixels[i * 4 + blue];
+    }
+    if (m_format == CaptureFormat::ppm) {
+      file_path += ".ppm";
+      auto header = "P6\n" + std::to_string(width) + ' '
+                  + std::to_string(height) + "\n255\n";
+      data.assign(header.begin(), header.end());
+      data.insert(data.end(), rgb.begin(), rgb.end());
+    } else {
+      file_path += ".png";
+      data = encode_png(rgb, slot.extent);
+    }
+  }
+
+  std::ofstream file{file_path, std::ios::binary};
+  file.write(reinterpret_cast<char const*>(data.data()),
+             static_cast<std::streamsize>(data.size()));
+  if (!file.good()) {
+    std::cerr << "failed to write " << file_path << '\n';
+    return false;
+  }
+  return true;
+}
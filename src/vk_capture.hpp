@@ -0,0 +1,91 @@
+#ifndef VK_CAPTURE_HPP
+#define VK_CAPTURE_HPP
+
+#include "vk_memory.hpp"
+#include "vk_types.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+enum class CaptureFormat
+{
+  // Tightly packed RGBA8, the size is in the file name
+  raw,
+  ppm,
+  // Uncompressed deflate blocks, large files but cheap to write
+  png,
+};
+
+// Writes rendered frames to disk without stalling the render thread. The
+// frame's own command buffer copies the image into a slot of a ring of host
+// visible buffers, the slot is handed to a writer thread once the frame has
+// completed on the GPU, and the thread encodes the pixels straight from the
+// mapping. When every slot is busy the frame is dropped rather than waited
+// for.
+class FrameCapture
+{
+  enum class SlotState
+  {
+    free,
+    // The copy is recorded, the frame is on the GPU
+    copying,
+    // Queued for, or being encoded by, the writer thread
+    writing,
+  };
+
+  struct Slot
+  {
+    AllocatedBuffer buffer;
+    SlotState state{SlotState::free};
+    uint64_t frame{0};
+    VkExtent2D extent{};
+    bool bgra{false};
+  };
+
+  DeviceAllocator* m_allocator{nullptr};
+  std::filesystem::path m_directory;
+  CaptureFormat m_format{CaptureFormat::ppm};
+  std::vector<Slot> m_slots;
+  uint32_t m_next_slot{0};
+  uint32_t m_written{0};
+  uint32_t m_dropped{0};
+
+  std::thread m_writer;
+  // Guards the slot states, the queue and m_stopping
+  std::mutex m_mutex;
+  std::condition_variable m_work_available;
+  std::queue<uint32_t> m_queue;
+  bool m_stopping{false};
+
+  void writer_loop();
+  bool write(Slot const& slot);
+
+ public:
+  // The slots are sized for extent, and grown when a larger frame is
+  // captured
+  void init(DeviceAllocator& allocator, std::filesystem::path directory,
+            CaptureFormat format, VkExtent2D extent, uint32_t slot_count);
+  // Write the frames already captured, which must have completed, then stop
+  // the writer thread
+  void destroy();
+
+  // Whether frames of this format can be captured
+  static bool supports(VkFormat format);
+  // Record the copy of image, in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL and
+  // visible to transfers, into a free slot. False if the frame is dropped
+  bool record(VkCommandBuffer cmd, VkImage image, VkExtent2D extent,
+              VkFormat format, uint64_t frame);
+  // Hand the slots of the frames before completed_frames, all finished on
+  // the GPU, to the writer thread
+  void collect(uint64_t completed_frames);
+
+  uint32_t written_frames();
+  uint32_t dropped_frames() const;
+};
+
+#endif // VK_CAPTURE_HPP
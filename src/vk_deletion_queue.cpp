@@ -0,0 +1,150 @@
+#include "vk_deletion_queue.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+template<typename Handle>
+Handle handle_cast(uint64_t bits)
+{
+  if constexpr (std::is_pointer_v<Handle>) {
+    return reinterpret_cast<Handle>(static_cast<std::uintptr_t>(bits));
+  } else {
+    return static_cast<Handle>(bits);
+  }
+}
+
+} // namespace
+
+void DeletionQueue::init(VkDevice device, DeviceAllocator* allocator)
+{
+  m_device    = device;
+  m_allocator = allocator;
+}
+
+std::size_t DeletionQueue::slot(VkObjectType type)
+{
+  auto it = std::find(m_order.begin(), m_order.end(), type);
+  if (it == m_order.end()) {
+    std::cerr << "deletion queue: unsupported object type " << type << '\n';
+    std::abort();
+  }
+  return static_cast<std::size_t>(it - m_order.begin());
+}
+
+void DeletionQueue::push(Allocation const& allocation, uint64_t frame)
+{
+  m_allocations.push_back({allocation, frame});
+}
+
+void DeletionQueue::push(AllocatedBuffer const& buffer, uint64_t frame)
+{
+  push(VK_OBJECT_TYPE_BUFFER, buffer.buffer, frame);
+  push(buffer.allocation, frame);
+}
+
+void DeletionQueue::push(AllocatedImage const& image, uint64_t frame)
+{
+  push(VK_OBJECT_TYPE_IMAGE, image.image, frame);
+  push(image.allocation, frame);
+}
+
+void DeletionQueue::collect(uint64_t completed_frames)
+{
+  release(completed_frames);
+}
+
+void DeletionQueue::flush()
+{
+  release(until_flush);
+}
+
+void DeletionQueue::release(uint64_t completed_frames)
+{
+  for (std::size_t i = 0; i < m_order.size(); ++i) {
+    // erase_if keeps the capacity, the arrays are reused by the next pushes
+    std::erase_if(m_records[i], [&](Record const& record) {
+      if (record.frame > completed_frames) {
+        return false;
+      }
+      destroy(m_order[i], record.handle);
+      return true;
+    });
+  }
+  std::erase_if(m_allocations, [&](AllocationRecord const& record) {
+    if (record.frame > completed_frames) {
+      return false;
+    }
+    m_allocator->free(record.allocation);
+    return true;
+  });
+}
+
+void DeletionQueue::destroy(VkObjectType type, uint64_t handle)
+{
+  switch (type) {
+  case VK_OBJECT_TYPE_PIPELINE:
+    vkDestroyPipeline(m_device, handle_cast<VkPipeline>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE_LAYOUT:
+    vkDestroyPipelineLayout(m_device, handle_cast<VkPipelineLayout>(handle),
+                            nullptr);
+    break;
+  case VK_OBJECT_TYPE_SHADER_MODULE:
+    vkDestroyShaderModule(m_device, handle_cast<VkShaderModule>(handle),
+                          nullptr);
+    break;
+  case VK_OBJECT_TYPE_PIPELINE_CACHE:
+    vkDestroyPipelineCache(m_device, handle_cast<VkPipelineCache>(handle),
+                           nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_POOL:
+    vkDestroyDescriptorPool(m_device, handle_cast<VkDescriptorPool>(handle),
+                            nullptr);
+    break;
+  case VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT:
+    vkDestroyDescriptorSetLayout(
+        m_device, handle_cast<VkDescriptorSetLayout>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_SAMPLER:
+    vkDestroySampler(m_device, handle_cast<VkSampler>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_FRAMEBUFFER:
+    vkDestroyFramebuffer(m_device, handle_cast<VkFramebuffer>(handle),
+                         nullptr);
+    break;
+  case VK_OBJECT_TYPE_RENDER_PASS:
+    vkDestroyRenderPass(m_device, handle_cast<VkRenderPass>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE_VIEW:
+    vkDestroyImageView(m_device, handle_cast<VkImageView>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_SWAPCHAIN_KHR:
+    vkDestroySwapchainKHR(m_device, handle_cast<VkSwapchainKHR>(handle),
+                          nullptr);
+    break;
+  case VK_OBJECT_TYPE_COMMAND_POOL:
+    vkDestroyCommandPool(m_device, handle_cast<VkCommandPool>(handle),
+                         nullptr);
+    break;
+  case VK_OBJECT_TYPE_QUERY_POOL:
+    vkDestroyQueryPool(m_device, handle_cast<VkQueryPool>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_SEMAPHORE:
+    vkDestroySemaphore(m_device, handle_cast<VkSemaphore>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_FENCE:
+    vkDestroyFence(m_device, handle_cast<VkFence>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_BUFFER:
+    vkDestroyBuffer(m_device, handle_cast<VkBuffer>(handle), nullptr);
+    break;
+  case VK_OBJECT_TYPE_IMAGE:
+    vkDestroyImage(m_device, handle_cast<VkImage>(handle), nullptr);
+    break;
+  default:
+    break;
+  }
+}
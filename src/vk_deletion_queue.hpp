@@ -0,0 +1,86 @@
+#ifndef VK_DELETION_QUEUE_HPP
+#define VK_DELETION_QUEUE_HPP
+
+#include "vk_memory.hpp"
+#include "vk_types.hpp"
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Deferred destruction of Vulkan objects. Objects are recorded as
+// (VkObjectType, handle) pairs in one array per type, so pushing and
+// collecting allocate nothing once the arrays have grown. Each record is
+// tagged with the first frame that no longer uses the object; collect()
+// destroys the records whose frames have all completed, flush() destroys
+// everything. Types are always destroyed in the same order, users before
+// the objects they depend on, and memory last.
+class DeletionQueue
+{
+ public:
+  // Frame tag of objects living until flush()
+  static constexpr uint64_t until_flush = std::numeric_limits<uint64_t>::max();
+
+ private:
+  struct Record
+  {
+    uint64_t handle;
+    uint64_t frame;
+  };
+
+  struct AllocationRecord
+  {
+    Allocation allocation;
+    uint64_t frame;
+  };
+
+  // Destruction order
+  static constexpr std::array<VkObjectType, 17> m_order{
+      VK_OBJECT_TYPE_PIPELINE,
+      VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+      VK_OBJECT_TYPE_SHADER_MODULE,
+      VK_OBJECT_TYPE_PIPELINE_CACHE,
+      VK_OBJECT_TYPE_DESCRIPTOR_POOL,
+      VK_OBJECT_TYPE_DESCRIPTOR_SET_LAYOUT,
+      VK_OBJECT_TYPE_SAMPLER,
+      VK_OBJECT_TYPE_FRAMEBUFFER,
+      VK_OBJECT_TYPE_RENDER_PASS,
+      VK_OBJECT_TYPE_IMAGE_VIEW,
+      VK_OBJECT_TYPE_SWAPCHAIN_KHR,
+      VK_OBJECT_TYPE_COMMAND_POOL,
+      VK_OBJECT_TYPE_QUERY_POOL,
+      VK_OBJECT_TYPE_SEMAPHORE,
+      VK_OBJECT_TYPE_FENCE,
+      VK_OBJECT_TYPE_BUFFER,
+      VK_OBJECT_TYPE_IMAGE,
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  DeviceAllocator* m_allocator{nullptr};
+  std::array<std::vector<Record>, m_order.size()> m_records;
+  std::vector<AllocationRecord> m_allocations;
+
+  static std::size_t slot(VkObjectType type);
+  void destroy(VkObjectType type, uint64_t handle);
+  void release(uint64_t completed_frames);
+
+ public:
+  void init(VkDevice device, DeviceAllocator* allocator);
+
+  template<typename Handle>
+  void push(VkObjectType type, Handle handle, uint64_t frame = until_flush)
+  {
+    m_records[slot(type)].push_back({handle_bits(handle), frame});
+  }
+  void push(Allocation const& allocation, uint64_t frame = until_flush);
+  void push(AllocatedBuffer const& buffer, uint64_t frame = until_flush);
+  void push(AllocatedImage const& image, uint64_t frame = until_flush);
+
+  // Destroy the objects no longer used by any frame, every frame before
+  // completed_frames having finished on the GPU
+  void collect(uint64_t completed_frames);
+  void flush();
+};
+
+#endif // VK_DELETION_QUEUE_HPP
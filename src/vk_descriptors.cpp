@@ -0,0 +1,276 @@
+#include "vk_descriptors.hpp"
+
+#include "vk_init.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+namespace {
+
+void hash_combine(std::size_t& seed, uint64_t value)
+{
+  seed ^= std::hash<uint64_t>{}(value) + 0x9e3779b9 + (seed << 6)
+        + (seed >> 2);
+}
+
+} // namespace
+
+std::size_t
+DescriptorAllocator::SetKeyHash::operator()(SetKey const& key) const
+{
+  std::size_t seed = 0;
+  hash_combine(seed, handle_bits(key.layout));
+  for (auto value : key.resources) {
+    hash_combine(seed, value);
+  }
+  return seed;
+}
+
+DescriptorAllocator::PoolSizes DescriptorAllocator::default_pool_sizes()
+{
+  return {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4.f},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2.f},
+      {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1.f},
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1.f},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4.f},
+      {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1.f},
+  };
+}
+
+void DescriptorAllocator::init(VkDevice device, uint32_t sets_per_pool,
+                               PoolSizes pool_sizes)
+{
+  m_device        = device;
+  m_sets_per_pool = sets_per_pool;
+  m_pool_sizes    = std::move(pool_sizes);
+}
+
+void DescriptorAllocator::destroy()
+{
+  for (auto pool : m_pools) {
+    vkDestroyDescriptorPool(m_device, pool, nullptr);
+  }
+  m_pools.clear();
+  m_sets.clear();
+  m_current_pool = VK_NULL_HANDLE;
+}
+
+VkDescriptorPool DescriptorAllocator::grab_pool()
+{
+  std::vector<VkDescriptorPoolSize> sizes;
+  for (auto [type, ratio] : m_pool_sizes) {
+    sizes.push_back(
+        {type, std::max(1u, static_cast<uint32_t>(ratio * m_sets_per_pool))});
+  }
+  VkDescriptorPoolCreateInfo pool_info{};
+  pool_info.sType         = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  pool_info.pNext         = nullptr;
+  pool_info.flags         = 0;
+  pool_info.maxSets       = m_sets_per_pool;
+  pool_info.poolSizeCount = static_cast<uint32_t>(sizes.size());
+  pool_info.pPoolSizes    = sizes.data();
+  VkDescriptorPool pool;
+  vk_check(vkCreateDescriptorPool(m_device, &pool_info, nullptr, &pool));
+  m_sets_per_pool = std::min(m_sets_per_pool * 2, max_sets_per_pool);
+  m_pools.push_back(pool);
+  return pool;
+}
+
+bool DescriptorAllocator::allocate(VkDescriptorSetLayout layout,
+                                   VkDescriptorSet* set)
+{
+  if (m_current_pool == VK_NULL_HANDLE) {
+    m_current_pool = grab_pool();
+  }
+  VkDescriptorSetAllocateInfo alloc_info{};
+  alloc_info.sType              = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  alloc_info.pNext              = nullptr;
+  alloc_info.descriptorPool     = m_current_pool;
+  alloc_info.descriptorSetCount = 1;
+  alloc_info.pSetLayouts        = &layout;
+  auto result = vkAllocateDescriptorSets(m_device, &alloc_info, set);
+  if (result == VK_ERROR_FRAGMENTED_POOL
+      || result == VK_ERROR_OUT_OF_POOL_MEMORY) {
+    // The pool is exhausted, carry on in another one
+    m_current_pool            = grab_pool();
+    alloc_info.descriptorPool = m_current_pool;
+    result = vkAllocateDescriptorSets(m_device, &alloc_info, set);
+  }
+  if (result != VK_SUCCESS) {
+    std::cerr << "failed to allocate descriptor set with error: " << result
+              << '\n';
+    return false;
+  }
+  return true;
+}
+
+VkDescriptorSet DescriptorAllocator::find(SetKey const& key) const
+{
+  auto it = m_sets.find(key);
+  return it == m_sets.end() ? VK_NULL_HANDLE : it->second;
+}
+
+void DescriptorAllocator::insert(SetKey key, VkDescriptorSet set)
+{
+  m_sets.emplace(std::move(key), set);
+}
+
+VkDevice DescriptorAllocator::device() const
+{
+  return m_device;
+}
+
+bool DescriptorLayoutCache::LayoutInfo::operator==(
+    LayoutInfo const& other) const
+{
+  return std::equal(
+      bindings.begin(), bindings.end(), other.bindings.begin(),
+      other.bindings.end(),
+      [](VkDescriptorSetLayoutBinding const& a,
+         VkDescriptorSetLayoutBinding const& b) {
+        return a.binding == b.binding && a.descriptorType == b.descriptorType
+               && a.descriptorCount == b.descriptorCount
+               && a.stageFlags == b.stageFlags
+               && a.pImmutableSamplers == b.pImmutableSamplers;
+      });
+}
+
+std::size_t
+DescriptorLayoutCache::LayoutInfoHash::operator()(LayoutInfo const& info) const
+{
+  std::size_t seed = info.bindings.size();
+  for (auto const& binding : info.bindings) {
+    hash_combine(seed, uint64_t{binding.binding}
+                           | uint64_t{binding.descriptorType} << 32);
+    hash_combine(seed, uint64_t{binding.descriptorCount}
+                           | uint64_t{binding.stageFlags} << 32);
+  }
+  return seed;
+}
+
+void DescriptorLayoutCache::init(VkDevice device)
+{
+  m_device = device;
+}
+
+void DescriptorLayoutCache::destroy()
+{
+  for (auto& [info, layout] : m_layouts) {
+    vkDestroyDescriptorSetLayout(m_device, layout, nullptr);
+  }
+  m_layouts.clear();
+}
+
+VkDescriptorSetLayout
+DescriptorLayoutCache::create_layout(VkDescriptorSetLayoutCreateInfo const& info)
+{
+  LayoutInfo key;
+  key.bindings.assign(info.pBindings, info.pBindings + info.bindingCount);
+  std::sort(key.bindings.begin(), key.bindings.end(),
+            [](VkDescriptorSetLayoutBinding const& a,
+               VkDescriptorSetLayoutBinding const& b) {
+              return a.binding < b.binding;
+            });
+  auto it = m_layouts.find(key);
+  if (it != m_layouts.end()) {
+    return it->second;
+  }
+  VkDescriptorSetLayout layout;
+  vk_check(vkCreateDescriptorSetLayout(m_device, &info, nullptr, &layout));
+  m_layouts.emplace(std::move(key), layout);
+  return layout;
+}
+
+DescriptorBuilder DescriptorBuilder::begin(DescriptorLayoutCache& cache,
+                                           DescriptorAllocator& allocator)
+{
+  DescriptorBuilder builder;
+  builder.m_cache     = &cache;
+  builder.m_allocator = &allocator;
+  return builder;
+}
+
+DescriptorBuilder& DescriptorBuilder::bind_buffer(
+    uint32_t binding, VkDescriptorBufferInfo const& info,
+    VkDescriptorType type, VkShaderStageFlags stage_flags)
+{
+  m_bindings.push_back(
+      vkinit::descriptorset_layout_binding(type, stage_flags, binding));
+  m_resources.push_back({info, {}, false});
+  return *this;
+}
+
+DescriptorBuilder& DescriptorBuilder::bind_image(
+    uint32_t binding, VkDescriptorImageInfo const& info, VkDescriptorType type,
+    VkShaderStageFlags stage_flags)
+{
+  m_bindings.push_back(
+      vkinit::descriptorset_layout_binding(type, stage_flags, binding));
+  m_resources.push_back({{}, info, true});
+  return *this;
+}
+
+bool DescriptorBuilder::build(VkDescriptorSet& set,
+                              VkDescriptorSetLayout& layout)
+{
+  VkDescriptorSetLayoutCreateInfo layout_info{};
+  layout_info.sType        = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  layout_info.pNext        = nullptr;
+  layout_info.flags        = 0;
+  layout_info.bindingCount = static_cast<uint32_t>(m_bindings.size());
+  layout_info.pBindings    = m_bindings.data();
+  layout                   = m_cache->create_layout(layout_info);
+
+  DescriptorAllocator::SetKey key{layout, {}};
+  for (std::size_t i = 0; i < m_bindings.size(); ++i) {
+    auto const& resource = m_resources[i];
+    key.resources.push_back(uint64_t{m_bindings[i].binding}
+                            | uint64_t{m_bindings[i].descriptorType} << 32);
+    if (resource.is_image) {
+      key.resources.push_back(handle_bits(resource.image.sampler));
+      key.resources.push_back(handle_bits(resource.image.imageView));
+      key.resources.push_back(resource.image.imageLayout);
+    } else {
+      key.resources.push_back(handle_bits(resource.buffer.buffer));
+      key.resources.push_back(resource.buffer.offset);
+      key.resources.push_back(resource.buffer.range);
+    }
+  }
+  set = m_allocator->find(key);
+  if (set != VK_NULL_HANDLE) {
+    return true;
+  }
+  if (!m_allocator->allocate(layout, &set)) {
+    return false;
+  }
+
+  std::vector<VkWriteDescriptorSet> writes;
+  for (std::size_t i = 0; i < m_bindings.size(); ++i) {
+    VkWriteDescriptorSet write{};
+    write.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.pNext           = nullptr;
+    write.dstSet          = set;
+    write.dstBinding      = m_bindings[i].binding;
+    write.descriptorCount = 1;
+    write.descriptorType  = m_bindings[i].descriptorType;
+    if (m_resources[i].is_image) {
+      write.pImageInfo = &m_resources[i].image;
+    } else {
+      write.pBufferInfo = &m_resources[i].buffer;
+    }
+    writes.push_back(write);
+  }
+  vkUpdateDescriptorSets(m_allocator->device(),
+                         static_cast<uint32_t>(writes.size()), writes.data(),
+                         0, nullptr);
+  m_allocator->insert(std::move(key), set);
+  return true;
+}
+
+bool DescriptorBuilder::build(VkDescriptorSet& set)
+{
+  VkDescriptorSetLayout layout;
+  return build(set, layout);
+}
@@ -0,0 +1,135 @@
+#ifndef VK_DESCRIPTORS_HPP
+#define VK_DESCRIPTORS_HPP
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Allocates descriptor sets from a list of pools, adding a pool whenever the
+// current one is exhausted. The sets live until destroy(). Sets built twice
+// with the same layout and resources are only allocated once, see
+// DescriptorBuilder.
+class DescriptorAllocator
+{
+ public:
+  // Descriptors of each type per set, scaled by the sets in a pool
+  using PoolSizes = std::vector<std::pair<VkDescriptorType, float>>;
+
+  struct SetKey
+  {
+    VkDescriptorSetLayout layout;
+    std::vector<uint64_t> resources;
+
+    bool operator==(SetKey const&) const = default;
+  };
+
+  struct SetKeyHash
+  {
+    std::size_t operator()(SetKey const& key) const;
+  };
+
+ private:
+  static constexpr uint32_t max_sets_per_pool = 4096;
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  PoolSizes m_pool_sizes;
+  // Doubled for every new pool, up to max_sets_per_pool
+  uint32_t m_sets_per_pool{0};
+  VkDescriptorPool m_current_pool{VK_NULL_HANDLE};
+  std::vector<VkDescriptorPool> m_pools;
+  std::unordered_map<SetKey, VkDescriptorSet, SetKeyHash> m_sets;
+
+  VkDescriptorPool grab_pool();
+
+ public:
+  static PoolSizes default_pool_sizes();
+
+  void init(VkDevice device, uint32_t sets_per_pool = 64,
+            PoolSizes pool_sizes = default_pool_sizes());
+  void destroy();
+
+  bool allocate(VkDescriptorSetLayout layout, VkDescriptorSet* set);
+
+  // A set built earlier with the same layout and resources, or
+  // VK_NULL_HANDLE
+  VkDescriptorSet find(SetKey const& key) const;
+  void insert(SetKey key, VkDescriptorSet set);
+  VkDevice device() const;
+};
+
+// Creates one descriptor set layout per distinct list of bindings, the
+// layouts live until destroy()
+class DescriptorLayoutCache
+{
+ public:
+  struct LayoutInfo
+  {
+    // Sorted by binding
+    std::vector<VkDescriptorSetLayoutBinding> bindings;
+
+    bool operator==(LayoutInfo const& other) const;
+  };
+
+  struct LayoutInfoHash
+  {
+    std::size_t operator()(LayoutInfo const& info) const;
+  };
+
+ private:
+  VkDevice m_device{VK_NULL_HANDLE};
+  std::unordered_map<LayoutInfo, VkDescriptorSetLayout, LayoutInfoHash>
+      m_layouts;
+
+ public:
+  void init(VkDevice device);
+  void destroy();
+
+  VkDescriptorSetLayout
+  create_layout(VkDescriptorSetLayoutCreateInfo const& info);
+};
+
+// Builds a descriptor set, and its layout, from the resources bound to it:
+//
+//   DescriptorBuilder::begin(layout_cache, allocator)
+//       .bind_buffer(0, buffer_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+//                    VK_SHADER_STAGE_VERTEX_BIT)
+//       .build(set, layout);
+//
+// The layout comes from the cache, and a set already built from the same
+// allocator with the same resources is reused rather than allocated again.
+class DescriptorBuilder
+{
+  struct Resource
+  {
+    VkDescriptorBufferInfo buffer;
+    VkDescriptorImageInfo image;
+    bool is_image;
+  };
+
+  DescriptorLayoutCache* m_cache{nullptr};
+  DescriptorAllocator* m_allocator{nullptr};
+  std::vector<VkDescriptorSetLayoutBinding> m_bindings;
+  std::vector<Resource> m_resources;
+
+ public:
+  static DescriptorBuilder begin(DescriptorLayoutCache& cache,
+                                 DescriptorAllocator& allocator);
+
+  DescriptorBuilder& bind_buffer(uint32_t binding,
+                                 VkDescriptorBufferInfo const& info,
+                                 VkDescriptorType type,
+                                 VkShaderStageFlags stage_flags);
+  DescriptorBuilder& bind_image(uint32_t binding,
+                                VkDescriptorImageInfo const& info,
+                                VkDescriptorType type,
+                                VkShaderStageFlags stage_flags);
+
+  bool build(VkDescriptorSet& set, VkDescriptorSetLayout& layout);
+  bool build(VkDescriptorSet& set);
+};
+
+#endif // VK_DESCRIPTORS_HPP
@@ -5,169 +5,705 @@
 #include <VkBootstrap.h>
 
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <thread>
+#include <tuple>
 
 #include "vk_init.hpp"
+#include "vk_pipeline_cache.hpp"
+#include "vk_trace.hpp"
 #include "vk_types.hpp"
 
-void vk_check(VkResult err)
+namespace {
+
+// constant_id values of triangle.frag.glsl
+enum ShaderConstant : uint32_t
+{
+  color_mode_constant  = 0,
+  solid_color_constant = 1, // 1 to 3, red, green and blue
+};
+
+enum ColorMode : uint32_t
+{
+  vertex_color_mode = 0,
+  solid_color_mode  = 1,
+};
+
+SpecializationConstants const& vertex_color_variant()
+{
+  static const auto constants = SpecializationConstants{}.set(
+      color_mode_constant, static_cast<uint32_t>(vertex_color_mode));
+  return constants;
+}
+
+SpecializationConstants const& red_variant()
+{
+  static const auto constants =
+      SpecializationConstants{}
+          .set(color_mode_constant, static_cast<uint32_t>(solid_color_mode))
+          .set(solid_color_constant + 0, 1.f)
+          .set(solid_color_constant + 1, 0.f)
+          .set(solid_color_constant + 2, 0.f);
+  return constants;
+}
+
+char const* present_mode_name(VkPresentModeKHR mode)
 {
-  if (err) {
-    std::cout << "Vulkan error: " << err << '\n';
+  switch (mode) {
+  case VK_PRESENT_MODE_IMMEDIATE_KHR:
+    return "IMMEDIATE";
+  case VK_PRESENT_MODE_MAILBOX_KHR:
+    return "MAILBOX";
+  case VK_PRESENT_MODE_FIFO_KHR:
+    return "FIFO";
+  case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+    return "FIFO_RELAXED";
+  default:
+    return "unknown";
+  }
+}
+
+using Milliseconds = std::chrono::duration<double, std::milli>;
+
+// The sets built at init are used by every frame, there is no going on
+// without one
+void check_built(bool built, char const* name)
+{
+  if (!built) {
+    std::cerr << "failed to build the " << name << " descriptor set\n";
     std::abort();
   }
 }
 
+// Push constants of particles.comp.glsl
+struct ParticlePushConstants
+{
+  float delta_time;
+  uint32_t particle_count;
+};
+
+constexpr uint32_t particle_group_size = 256;
+
+// Push constants of cull.comp.glsl
+struct CullPushConstants
+{
+  std::array<glm::vec4, 6> planes;
+  uint32_t object_count;
+};
+
+constexpr uint32_t cull_group_size = 256;
+
+// Planes of the view frustum of view_projection, normalized and pointing
+// inwards, for a [0, 1] clip space depth range
+std::array<glm::vec4, 6> frustum_planes(glm::mat4 const& view_projection)
+{
+  // glm matrices are column major
+  auto row = [&](int i) {
+    return glm::vec4{view_projection[0][i], view_projection[1][i],
+                     view_projection[2][i], view_projection[3][i]};
+  };
+  std::array<glm::vec4, 6> planes{row(3) + row(0), row(3) - row(0),
+                                  row(3) + row(1), row(3) - row(1),
+                                  row(2),          row(3) - row(2)};
+  for (auto& plane : planes) {
+    plane /= glm::length(glm::vec3{plane});
+  }
+  return planes;
+}
+
+} // namespace
+
 void VulkanEngine::init_vulkan()
 {
+  TRACE_SCOPE("init_vulkan");
   vkb::InstanceBuilder builder;
   auto instance = builder.set_app_name("Example Vulkan Application")
                       .request_validation_layers(true)
                       .require_api_version(1, 1, 0)
+                      .set_headless(m_config.headless)
                       .use_default_debug_messenger()
                       .build();
+  if (!instance) {
+    std::cerr << "failed to create Vulkan instance: "
+              << instance.error().message() << '\n';
+    std::abort();
+  }
   auto vkb_instance = instance.value();
   m_instance        = vkb_instance.instance;
   m_debug_messenger = vkb_instance.debug_messenger;
 
-  auto result = SDL_Vulkan_CreateSurface(m_window, m_instance, &m_surface);
-  if (result == SDL_FALSE) {
-    std::cerr << "failed create SDL Vulkan Surface, SDL Error: "
-              << SDL_GetError() << '\n';
+  vkb::PhysicalDeviceSelector selector{vkb_instance};
+  selector.set_minimum_version(1, 1);
+  // Uploads signal a timeline semaphore the frames wait on
+  selector.add_required_extension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+  if (m_config.gpu_culling) {
+    // The indirect draws start at the first instance of their batch
+    VkPhysicalDeviceFeatures required_features{};
+    required_features.drawIndirectFirstInstance = VK_TRUE;
+    selector.set_required_features(required_features);
+  }
+  if (m_config.headless) {
+    // No surface: any device with a graphics queue will do, including
+    // software implementations like lavapipe
+    m_surface = VK_NULL_HANDLE;
+  } else {
+    auto result = SDL_Vulkan_CreateSurface(m_window, m_instance, &m_surface);
+    if (result == SDL_FALSE) {
+      std::cerr << "failed create SDL Vulkan Surface, SDL Error: "
+                << SDL_GetError() << '\n';
+      std::abort();
+    }
+    selector.set_surface(m_surface);
+  }
+  auto selected = selector.select();
+  if (!selected) {
+    std::cerr << "failed to select a physical device: "
+              << selected.error().message() << '\n';
     std::abort();
   }
-
-  vkb::PhysicalDeviceSelector selector{vkb_instance};
-  vkb::PhysicalDevice physical_device = selector.set_minimum_version(1, 1)
-                                            .set_surface(m_surface)
-                                            .select()
-                                            .value();
+  vkb::PhysicalDevice physical_device = selected.value();
+  // Dynamic rendering comes from the extension, and the ones it depends on,
+  // as the instance is Vulkan 1.1. Without it the frame is recorded with
+  // render pass and framebuffer objects
+  VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timeline_features{};
+  timeline_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+  VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamic_rendering_features{};
+  dynamic_rendering_features.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+  VkPhysicalDeviceFeatures2 features{};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+  features.pNext = &timeline_features;
+  if (m_config.dynamic_rendering
+      && physical_device.enable_extensions_if_present(
+          {VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME,
+           VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
+           VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME})) {
+    timeline_features.pNext = &dynamic_rendering_features;
+  }
+  vkGetPhysicalDeviceFeatures2(physical_device.physical_device, &features);
+  if (timeline_features.timelineSemaphore != VK_TRUE) {
+    std::cerr << "the device does not support timeline semaphores\n";
+    std::abort();
+  }
+  m_dynamic_rendering = dynamic_rendering_features.dynamicRendering == VK_TRUE;
+  // Only the features in use are enabled, the others were left to false
+  timeline_features.pNext = nullptr;
   vkb::DeviceBuilder device_builder{physical_device};
+  device_builder.add_pNext(&timeline_features);
+  if (m_dynamic_rendering) {
+    device_builder.add_pNext(&dynamic_rendering_features);
+  }
   vkb::Device vkb_device = device_builder.build().value();
 
   m_device         = vkb_device.device;
   m_chosen_gpu     = physical_device.physical_device;
+  m_gpu_properties = physical_device.properties;
   m_graphics_queue = vkb_device.get_queue(vkb::QueueType::graphics).value();
   m_graphics_queue_family =
       vkb_device.get_queue_index(vkb::QueueType::graphics).value();
+  // A compute family without graphics runs the simulation alongside the
+  // graphics work instead of being serialized with it. Such families usually
+  // support transfers too, so a dedicated one is not asked for
+  auto compute_queue = vkb_device.get_queue(vkb::QueueType::compute);
+  if (compute_queue) {
+    m_compute_queue = compute_queue.value();
+    m_compute_queue_family =
+        vkb_device.get_queue_index(vkb::QueueType::compute).value();
+    std::cerr << "async compute queue family: " << m_compute_queue_family
+              << '\n';
+  } else {
+    m_compute_queue        = m_graphics_queue;
+    m_compute_queue_family = m_graphics_queue_family;
+    std::cerr << "compute on the graphics queue family: "
+              << m_compute_queue_family << '\n';
+  }
+  // Likewise a transfer only family, usually backed by copy engines, runs
+  // the uploads without taking time from the graphics queue
+  auto transfer_queue =
+      vkb_device.get_dedicated_queue(vkb::QueueType::transfer);
+  if (transfer_queue) {
+    m_transfer_queue = transfer_queue.value();
+    m_transfer_queue_family =
+        vkb_device.get_dedicated_queue_index(vkb::QueueType::transfer)
+            .value();
+    std::cerr << "transfer queue family: " << m_transfer_queue_family << '\n';
+  } else {
+    m_transfer_queue        = m_graphics_queue;
+    m_transfer_queue_family = m_graphics_queue_family;
+  }
+
+  if (m_dynamic_rendering) {
+    m_cmd_begin_rendering = reinterpret_cast<PFN_vkCmdBeginRenderingKHR>(
+        vkGetDeviceProcAddr(m_device, "vkCmdBeginRenderingKHR"));
+    m_cmd_end_rendering = reinterpret_cast<PFN_vkCmdEndRenderingKHR>(
+        vkGetDeviceProcAddr(m_device, "vkCmdEndRenderingKHR"));
+  }
+  std::cerr << "rendering with "
+            << (m_dynamic_rendering ? "dynamic rendering" : "render passes")
+            << '\n';
+
+  m_allocator.init(m_chosen_gpu, m_device);
+  m_deletion_queue.init(m_device, &m_allocator);
+  m_uploads.init(m_device, m_allocator, m_transfer_queue,
+                 m_transfer_queue_family, m_graphics_queue_family);
+  m_shader_library.init(m_device);
+  m_gpu_profiler.init(m_chosen_gpu, m_device, m_graphics_queue_family,
+                      static_cast<uint32_t>(m_frames.size()));
 }
 
 void VulkanEngine::init_swapchain()
 {
+  TRACE_SCOPE("init_swapchain");
+  if (m_config.headless) {
+    init_offscreen_images();
+    return;
+  }
+  create_swapchain(VK_NULL_HANDLE);
+}
+
+void VulkanEngine::create_swapchain(VkSwapchainKHR old_swapchain)
+{
+  int width, height;
+  SDL_Vulkan_GetDrawableSize(m_window, &width, &height);
   vkb::SwapchainBuilder swapchain_builder{m_chosen_gpu, m_device, m_surface};
-  vkb::Swapchain vkb_swapchain =
-      swapchain_builder.use_default_format_selection()
-          .set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR) // vsync
-          .set_desired_extent(m_window_extend.width, m_window_extend.height)
-          .build()
-          .value();
+  swapchain_builder.use_default_format_selection()
+      .set_desired_extent(width, height)
+      .set_old_swapchain(old_swapchain);
+  if (!m_config.capture_directory.empty()) {
+    // The capture copies the images out
+    swapchain_builder.add_image_usage_flags(VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+  }
+  if (m_config.low_latency) {
+    // MAILBOX replaces the queued image instead of blocking, IMMEDIATE may
+    // tear. vk-bootstrap falls back to FIFO when neither is supported
+    swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_MAILBOX_KHR)
+        .add_fallback_present_mode(VK_PRESENT_MODE_IMMEDIATE_KHR);
+  } else {
+    // vsync
+    swapchain_builder.set_desired_present_mode(VK_PRESENT_MODE_FIFO_KHR);
+  }
+  vkb::Swapchain vkb_swapchain = swapchain_builder.build().value();
 
+  if (old_swapchain != VK_NULL_HANDLE
+      && vkb_swapchain.image_format != m_swapchain_image_format) {
+    std::cerr << "swapchain format changed, the render pass is stale\n";
+  }
   m_swapchain              = vkb_swapchain.swapchain;
+  m_window_extend          = vkb_swapchain.extent;
   m_swapchain_images       = vkb_swapchain.get_images().value();
   m_swapchain_image_views  = vkb_swapchain.get_image_views().value();
   m_swapchain_image_format = vkb_swapchain.image_format;
-  m_main_deletion_queue.push(
-      [=] { vkDestroySwapchainKHR(m_device, m_swapchain, nullptr); });
+  if (old_swapchain == VK_NULL_HANDLE) {
+    std::cerr << "present mode: "
+              << present_mode_name(vkb_swapchain.present_mode) << '\n';
+  }
+  m_present_mode = vkb_swapchain.present_mode;
+}
+
+void VulkanEngine::init_offscreen_images()
+{
+  // One image per frame in flight, so a frame never waits on another one to
+  // release its render target
+  const auto image_count   = static_cast<uint32_t>(m_frames.size());
+  m_swapchain              = VK_NULL_HANDLE;
+  m_swapchain_image_format = VK_FORMAT_R8G8B8A8_UNORM;
+  m_swapchain_images       = std::vector<VkImage>(image_count);
+  m_swapchain_image_views  = std::vector<VkImageView>(image_count);
+  m_offscreen_images       = std::vector<AllocatedImage>(image_count);
+
+  auto image_info = vkinit::image_create_info(
+      m_swapchain_image_format,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+      {m_window_extend.width, m_window_extend.height, 1});
+  for (uint32_t i = 0; i < image_count; ++i) {
+    m_offscreen_images[i] = m_allocator.create_image(
+        image_info, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_swapchain_images[i] = m_offscreen_images[i].image;
+
+    auto view_info = vkinit::imageview_create_info(
+        m_swapchain_image_format, m_swapchain_images[i],
+        VK_IMAGE_ASPECT_COLOR_BIT);
+    vk_check(vkCreateImageView(m_device, &view_info, nullptr,
+                               &m_swapchain_image_views[i]));
+    m_deletion_queue.push(m_offscreen_images[i]);
+  }
 }
 
 void VulkanEngine::init_commands()
 {
+  TRACE_SCOPE("init_commands");
   auto command_pool_info{vkinit::command_pool_create_info(
       m_graphics_queue_family,
       VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)};
-  vk_check(vkCreateCommandPool(m_device, &command_pool_info, nullptr,
-                               &m_command_pool));
+  for (auto& frame : m_frames) {
+    vk_check(vkCreateCommandPool(m_device, &command_pool_info, nullptr,
+                                 &frame.command_pool));
+
+    auto cmd_alloc_info{
+        vkinit::command_buffer_allocate_info(frame.command_pool, 1)};
+    vk_check(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
+                                      &frame.main_command_buffer));
+    m_deletion_queue.push(VK_OBJECT_TYPE_COMMAND_POOL, frame.command_pool);
+
+    // Secondary command buffers for parallel recording. The pools are reset
+    // as a whole by the job using them, hence no reset bit
+    auto worker_pool_info{
+        vkinit::command_pool_create_info(m_graphics_queue_family, 0)};
+    const auto worker_count = m_jobs.worker_count();
+    frame.worker_command_pools.resize(worker_count);
+    frame.worker_command_buffers.resize(worker_count);
+    for (uint32_t i = 0; i < worker_count; ++i) {
+      vk_check(vkCreateCommandPool(m_device, &worker_pool_info, nullptr,
+                                   &frame.worker_command_pools[i]));
+      auto worker_alloc_info{vkinit::command_buffer_allocate_info(
+          frame.worker_command_pools[i], 1,
+          VK_COMMAND_BUFFER_LEVEL_SECONDARY)};
+      vk_check(vkAllocateCommandBuffers(m_device, &worker_alloc_info,
+                                        &frame.worker_command_buffers[i]));
+      m_deletion_queue.push(VK_OBJECT_TYPE_COMMAND_POOL,
+                            frame.worker_command_pools[i]);
+    }
+
+    auto compute_pool_info{vkinit::command_pool_create_info(
+        m_compute_queue_family,
+        VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT)};
+    vk_check(vkCreateCommandPool(m_device, &compute_pool_info, nullptr,
+                                 &frame.compute_command_pool));
+    auto compute_alloc_info{
+        vkinit::command_buffer_allocate_info(frame.compute_command_pool, 1)};
+    vk_check(vkAllocateCommandBuffers(m_device, &compute_alloc_info,
+                                      &frame.compute_command_buffer));
+    m_deletion_queue.push(VK_OBJECT_TYPE_COMMAND_POOL,
+                          frame.compute_command_pool);
+  }
 
-  auto cmd_alloc_info{vkinit::command_buffer_allocate_info(m_command_pool, 1)};
+  vk_check(vkCreateCommandPool(m_device, &command_pool_info, nullptr,
+                               &m_immediate_command_pool));
+  auto cmd_alloc_info{
+      vkinit::command_buffer_allocate_info(m_immediate_command_pool, 1)};
   vk_check(vkAllocateCommandBuffers(m_device, &cmd_alloc_info,
-                                    &m_main_command_buffer));
-  m_main_deletion_queue.push(
-      [=] { vkDestroyCommandPool(m_device, m_command_pool, nullptr); });
-}
-
-void VulkanEngine::init_default_renderpass()
-{
-  VkAttachmentDescription color_attachment{};
-  color_attachment.format         = m_swapchain_image_format;
-  color_attachment.samples        = VK_SAMPLE_COUNT_1_BIT;
-  color_attachment.loadOp         = VK_ATTACHMENT_LOAD_OP_CLEAR;
-  color_attachment.storeOp        = VK_ATTACHMENT_STORE_OP_STORE;
-  color_attachment.stencilLoadOp  = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-  color_attachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  color_attachment.initialLayout  = VK_IMAGE_LAYOUT_UNDEFINED;
-  color_attachment.finalLayout    = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-  VkAttachmentReference color_attachment_ref{};
-  color_attachment_ref.attachment = 0;
-  color_attachment_ref.layout     = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-  VkSubpassDescription subpass{};
-  subpass.pipelineBindPoint    = VK_PIPELINE_BIND_POINT_GRAPHICS;
-  subpass.colorAttachmentCount = 1;
-  subpass.pColorAttachments    = &color_attachment_ref;
-
-  VkRenderPassCreateInfo render_pass_info{};
-  render_pass_info.sType           = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-  render_pass_info.attachmentCount = 1;
-  render_pass_info.pAttachments    = &color_attachment;
-  render_pass_info.subpassCount    = 1;
-  render_pass_info.pSubpasses      = &subpass;
-  vk_check(
-      vkCreateRenderPass(m_device, &render_pass_info, nullptr, &m_render_pass));
-  m_main_deletion_queue.push(
-      [=] { vkDestroyRenderPass(m_device, m_render_pass, nullptr); });
-}
-
-void VulkanEngine::init_framebuffers()
-{
-  VkFramebufferCreateInfo fb_info{};
-  fb_info.sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-  fb_info.pNext           = nullptr;
-  fb_info.renderPass      = m_render_pass;
-  fb_info.attachmentCount = 1;
-  fb_info.width           = m_window_extend.width;
-  fb_info.height          = m_window_extend.height;
-  fb_info.layers          = 1;
-
-  const uint32_t swapchain_image_count = m_swapchain_images.size();
-  m_frame_buffers = std::vector<VkFramebuffer>(swapchain_image_count);
-  for (auto i = 0; i < swapchain_image_count; ++i) {
-    fb_info.pAttachments = &m_swapchain_image_views[i];
-    auto result =
-        vkCreateFramebuffer(m_device, &fb_info, nullptr, &m_frame_buffers[i]);
-    vk_check(result);
-    m_main_deletion_queue.push(
-        [=] { vkDestroyFramebuffer(m_device, m_frame_buffers[i], nullptr); });
-    m_main_deletion_queue.push([=] {
-      vkDestroyImageView(m_device, m_swapchain_image_views[i], nullptr);
-    });
+                                    &m_immediate_command_buffer));
+  m_deletion_queue.push(VK_OBJECT_TYPE_COMMAND_POOL, m_immediate_command_pool);
+}
+
+void VulkanEngine::init_render_graph()
+{
+  TRACE_SCOPE("init_render_graph");
+  m_render_graph.init(m_device, m_allocator, m_deletion_queue,
+                      m_window_extend);
+  // Swapchain images are handed over by the acquire semaphore, waited on at
+  // the color output stage. Offscreen images are left ready to be copied out
+  // for readback
+  if (m_config.headless) {
+    m_backbuffer = m_render_graph.import_image(
+        "backbuffer", m_swapchain_image_format, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+  } else {
+    m_backbuffer = m_render_graph.import_image(
+        "backbuffer", m_swapchain_image_format, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  }
+  m_main_pass = m_render_graph.add_pass(
+      "main",
+      [this](VkCommandBuffer cmd, RenderGraph::PassContext const& context) {
+        record_main_pass(cmd, context);
+      });
+  m_render_graph.write_color(m_main_pass, m_backbuffer, VkClearValue{});
+  m_capturing = !m_config.capture_directory.empty();
+  if (m_capturing && !FrameCapture::supports(m_swapchain_image_format)) {
+    std::cerr << "cannot capture frames of format " << m_swapchain_image_format
+              << '\n';
+    m_capturing = false;
+  }
+  if (m_capturing) {
+    // Recorded after the main pass, at the end of the frame's command buffer
+    m_capture_pass = m_render_graph.add_pass(
+        "capture", [this](VkCommandBuffer cmd, RenderGraph::PassContext const&) {
+          record_capture(cmd);
+        });
+    m_render_graph.read_transfer(m_capture_pass, m_backbuffer);
+    m_render_graph.set_side_effects(m_capture_pass);
+    // A slot per frame in flight, and two more for the writer to fall
+    // behind before frames are dropped
+    m_capture.init(m_allocator, m_config.capture_directory,
+                   m_config.capture_format, m_window_extend,
+                   static_cast<uint32_t>(m_frames.size()) + 2);
   }
+  if (m_dynamic_rendering) {
+    m_render_graph.set_dynamic_rendering(m_cmd_begin_rendering,
+                                         m_cmd_end_rendering);
+  }
+  m_render_graph.compile();
+  // The pipelines are built against the render pass of the main pass, or
+  // its attachment formats with dynamic rendering
+  m_render_pass  = m_render_graph.render_pass(m_main_pass);
+  m_main_formats = m_render_graph.rendering_formats(m_main_pass);
 }
 
-void VulkanEngine::init_sync_structures()
+void VulkanEngine::recreate_swapchain()
 {
-  auto fence_info = vkinit::create_fence_info(VK_FENCE_CREATE_SIGNALED_BIT);
-  vk_check(vkCreateFence(m_device, &fence_info, nullptr, &m_render_fence));
-  m_main_deletion_queue.push(
-      [=] { vkDestroyFence(m_device, m_render_fence, nullptr); });
+  int width, height;
+  SDL_Vulkan_GetDrawableSize(m_window, &width, &height);
+  if (width == 0 || height == 0) {
+    // Minimized, keep the resize pending until the window is visible again
+    return;
+  }
+  m_resize_requested = false;
+
+  // Only the swapchain, its views and the render graph images and
+  // framebuffers depend on the window size. The old swapchain is retired
+  // rather than waited on: frames in flight keep presenting from it and it is
+  // destroyed once they are done
+  auto old_swapchain = m_swapchain;
+  retire_swapchain();
+  create_swapchain(old_swapchain);
+  m_render_graph.resize(m_window_extend, m_frame_number);
+  m_images_in_flight = std::vector<VkFence>(m_swapchain_images.size(),
+                                            VK_NULL_HANDLE);
+}
 
+void VulkanEngine::retire_swapchain()
+{
+  // Frames already submitted keep presenting from the swapchain, it goes
+  // away once they are done
+  const auto frame = static_cast<uint64_t>(m_frame_number);
+  for (auto image_view : m_swapchain_image_views) {
+    m_deletion_queue.push(VK_OBJECT_TYPE_IMAGE_VIEW, image_view, frame);
+  }
+  if (m_swapchain != VK_NULL_HANDLE) {
+    m_deletion_queue.push(VK_OBJECT_TYPE_SWAPCHAIN_KHR, m_swapchain, frame);
+  }
+  m_swapchain = VK_NULL_HANDLE;
+  m_swapchain_image_views.clear();
+}
+
+void VulkanEngine::init_sync_structures()
+{
+  TRACE_SCOPE("init_sync_structures");
+  auto fence_info     = vkinit::create_fence_info(VK_FENCE_CREATE_SIGNALED_BIT);
   auto semaphore_info = vkinit::create_semaphore_info(0);
-  vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr,
-                             &m_present_semaphore));
-  vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr,
-                             &m_render_semaphore));
-  m_main_deletion_queue.push(
-      [=] { vkDestroySemaphore(m_device, m_present_semaphore, nullptr); });
-  m_main_deletion_queue.push(
-      [=] { vkDestroySemaphore(m_device, m_render_semaphore, nullptr); });
+  for (auto& frame : m_frames) {
+    vk_check(
+        vkCreateFence(m_device, &fence_info, nullptr, &frame.render_fence));
+    m_deletion_queue.push(VK_OBJECT_TYPE_FENCE, frame.render_fence);
+
+    vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr,
+                               &frame.present_semaphore));
+    vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr,
+                               &frame.render_semaphore));
+    m_deletion_queue.push(VK_OBJECT_TYPE_SEMAPHORE, frame.present_semaphore);
+    m_deletion_queue.push(VK_OBJECT_TYPE_SEMAPHORE, frame.render_semaphore);
+
+    vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr,
+                               &frame.compute_semaphore));
+    m_deletion_queue.push(VK_OBJECT_TYPE_SEMAPHORE, frame.compute_semaphore);
+  }
+  m_images_in_flight = std::vector<VkFence>(m_swapchain_images.size(),
+                                            VK_NULL_HANDLE);
+
+  auto immediate_fence_info = vkinit::create_fence_info({});
+  vk_check(vkCreateFence(m_device, &immediate_fence_info, nullptr,
+                         &m_immediate_fence));
+  m_deletion_queue.push(VK_OBJECT_TYPE_FENCE, m_immediate_fence);
+}
+
+void VulkanEngine::init_pipeline_cache()
+{
+  TRACE_SCOPE("init_pipeline_cache");
+  if (m_config.pipeline_cache_path.empty()) {
+    m_pipeline_cache_warm = false;
+    auto info{vkinit::pipeline_cache_create_info()};
+    vk_check(
+        vkCreatePipelineCache(m_device, &info, nullptr, &m_pipeline_cache));
+  } else {
+    m_pipeline_cache = vkutil::load_pipeline_cache(
+        m_device, m_gpu_properties, m_config.pipeline_cache_path,
+        &m_pipeline_cache_warm);
+  }
+  m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_CACHE, m_pipeline_cache);
+}
+
+void VulkanEngine::init_descriptors()
+{
+  TRACE_SCOPE("init_descriptors");
+  // Sets built at init live for the whole run
+  m_layout_cache.init(m_device);
+  m_descriptor_allocator.init(m_device);
+
+  // One ring partition per frame, selected with the dynamic offset
+  const auto frame_count = static_cast<uint32_t>(m_frames.size());
+  m_uniforms.init(m_allocator, m_chosen_gpu, frame_count);
+  m_deletion_queue.push(m_uniforms.buffer());
+  check_built(
+      DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+          .bind_buffer(0, {m_uniforms.buffer().buffer, 0, sizeof(GPUFrameData)},
+                       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+                       VK_SHADER_STAGE_VERTEX_BIT
+                           | VK_SHADER_STAGE_FRAGMENT_BIT)
+          .build(m_frame_descriptor, m_frame_set_layout),
+      "frame");
+
+  const VkDeviceSize instance_buffer_size =
+      sizeof(GPUInstanceData) * VkDeviceSize{m_config.max_instances};
+  const VkDeviceSize ids_size =
+      sizeof(uint32_t) * VkDeviceSize{m_config.max_instances};
+  std::vector<uint32_t> ids(m_config.max_instances);
+  for (uint32_t i = 0; i < m_config.max_instances; ++i) {
+    ids[i] = i;
+  }
+  m_identity_ids = create_typed_buffer(m_allocator,
+                                       std::span<uint32_t const>{ids},
+                                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT)
+                       .buffer;
+  m_deletion_queue.push(m_identity_ids);
+
+  for (auto& frame : m_frames) {
+    // Rewritten by the CPU when the scene changes, so keep it mapped for the
+    // whole run
+    frame.instance_buffer = m_allocator.create_buffer(
+        instance_buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_deletion_queue.push(frame.instance_buffer);
+
+    VkDescriptorBufferInfo instance_info{frame.instance_buffer.buffer, 0,
+                                         instance_buffer_size};
+    check_built(
+        DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+            .bind_buffer(0, instance_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            .bind_buffer(1, {m_identity_ids.buffer, 0, ids_size},
+                         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            .build(frame.instance_descriptor, m_instance_set_layout),
+        "instance");
+    if (!m_config.gpu_culling) {
+      continue;
+    }
+
+    // Bounds and draws are written by the CPU, the visible ids only ever by
+    // the culling pass. At worst every instance is its own batch
+    const VkDeviceSize bounds_size =
+        sizeof(GPUObjectBounds) * VkDeviceSize{m_config.max_instances};
+    const VkDeviceSize draws_size = sizeof(VkDrawIndexedIndirectCommand)
+                                    * VkDeviceSize{m_config.max_instances};
+    frame.bounds_buffer = m_allocator.create_buffer(
+        bounds_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.draw_command_buffer = m_allocator.create_buffer(
+        draws_size,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    frame.visible_buffer = m_allocator.create_buffer(
+        ids_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    m_deletion_queue.push(frame.bounds_buffer);
+    m_deletion_queue.push(frame.draw_command_buffer);
+    m_deletion_queue.push(frame.visible_buffer);
+
+    VkDescriptorBufferInfo visible_info{frame.visible_buffer.buffer, 0,
+                                        ids_size};
+    check_built(
+        DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+            .bind_buffer(0, instance_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            .bind_buffer(1, visible_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            .build(frame.culled_instance_descriptor),
+        "culled instance");
+    check_built(
+        DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+            .bind_buffer(0, {frame.bounds_buffer.buffer, 0, bounds_size},
+                         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_buffer(1, {frame.draw_command_buffer.buffer, 0, draws_size},
+                         VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_buffer(2, visible_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            .build(frame.cull_descriptor, m_cull_set_layout),
+        "culling");
+  }
+}
+
+void VulkanEngine::init_particles()
+{
+  TRACE_SCOPE("init_particles");
+  if (m_config.particle_count == 0) {
+    return;
+  }
+  // Random positions and velocities, colored by direction
+  std::vector<GPUParticle> particles(m_config.particle_count);
+  std::mt19937 rng{42};
+  std::uniform_real_distribution<float> position{-1.f, 1.f};
+  std::uniform_real_distribution<float> velocity{-0.5f, 0.5f};
+  for (auto& particle : particles) {
+    particle.position = {position(rng), position(rng)};
+    particle.velocity = {velocity(rng), velocity(rng)};
+    particle.color    = {0.5f + particle.velocity.x, 0.5f + particle.velocity.y,
+                         1.f, 1.f};
+  }
+
+  // Written by the compute queue and read by the graphics queue. Concurrent
+  // sharing spares the queue family ownership transfers
+  const uint32_t queue_families[] = {m_graphics_queue_family,
+                                     m_compute_queue_family};
+  const VkDeviceSize buffer_size = sizeof(GPUParticle) * particles.size();
+  for (auto& frame : m_frames) {
+    frame.particle_buffer = m_allocator.create_buffer(
+        buffer_size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, queue_families);
+    std::memcpy(frame.particle_buffer.allocation.mapped, particles.data(),
+                buffer_size);
+    m_allocator.flush(frame.particle_buffer.allocation);
+    m_deletion_queue.push(frame.particle_buffer);
+  }
+
+  const auto frame_count = m_frames.size();
+  for (std::size_t i = 0; i < frame_count; ++i) {
+    auto& frame    = m_frames[i];
+    auto& previous = m_frames[(i + frame_count - 1) % frame_count];
+    VkDescriptorBufferInfo input_info{previous.particle_buffer.buffer, 0,
+                                      buffer_size};
+    VkDescriptorBufferInfo output_info{frame.particle_buffer.buffer, 0,
+                                       buffer_size};
+    check_built(
+        DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+            .bind_buffer(0, input_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            .bind_buffer(1, output_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_COMPUTE_BIT)
+            .build(frame.particle_compute_descriptor,
+                   m_particle_compute_set_layout),
+        "particle simulation");
+    check_built(
+        DescriptorBuilder::begin(m_layout_cache, m_descriptor_allocator)
+            .bind_buffer(0, output_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_VERTEX_BIT)
+            .build(frame.particle_render_descriptor,
+                   m_particle_render_set_layout),
+        "particle rendering");
+  }
+  m_last_simulation_time = std::chrono::steady_clock::now();
 }
 
 void VulkanEngine::init_pipelines()
 {
+  TRACE_SCOPE("init_pipelines");
   VkShaderModule vert_shader;
   if (load_shader_module("shaders/triangle.vert.spv", &vert_shader)) {
     std::cerr << "Triangle vertex shader successfully loaded\n";
@@ -182,38 +718,31 @@ void VulkanEngine::init_pipelines()
     std::cerr << "Error loading triangle fragment shader\n";
   }
 
-  VkShaderModule red_vert_shader;
-  if (load_shader_module("shaders/triangle_red.vert.spv", &red_vert_shader)) {
-    std::cerr << "Red triangle vertex shader successfully loaded\n";
+  VkShaderModule mesh_vert_shader;
+  if (load_shader_module("shaders/mesh.vert.spv", &mesh_vert_shader)) {
+    std::cerr << "Mesh vertex shader successfully loaded\n";
   } else {
-    std::cerr << "Error loading red triangle vertex shader\n";
-  }
-
-  VkShaderModule red_frag_shader;
-  if (load_shader_module("shaders/triangle_red.frag.spv", &red_frag_shader)) {
-    std::cerr << "Red triangle fragment shader successfully loaded\n";
-  } else {
-    std::cerr << "Error loading red triangle fragment shader\n";
+    std::cerr << "Error loading mesh vertex shader\n";
   }
 
   auto pipeline_layout_info = vkinit::pipeline_layout_create_info();
   vk_check(vkCreatePipelineLayout(m_device, &pipeline_layout_info, nullptr,
                                   &m_triangle_pipeline_layout));
 
+  VkDescriptorSetLayout mesh_set_layouts[] = {m_instance_set_layout,
+                                              m_frame_set_layout};
+  auto mesh_layout_info = vkinit::pipeline_layout_create_info(mesh_set_layouts);
+  vk_check(vkCreatePipelineLayout(m_device, &mesh_layout_info, nullptr,
+                                  &m_mesh_pipeline_layout));
+
   PipelineBuilder pipeline_builder;
   pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
       VK_SHADER_STAGE_VERTEX_BIT, vert_shader));
   pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
       VK_SHADER_STAGE_FRAGMENT_BIT, frag_shader));
 
-  pipeline_builder.set_vertex_input_info(
-      vkinit::vertex_input_state_create_info());
   pipeline_builder.set_input_assembly_info(
       vkinit::init_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST));
-  pipeline_builder.set_viewport(
-      {0.0f, 0.0f, static_cast<float>(m_window_extend.width),
-       static_cast<float>(m_window_extend.height), 0.0f, 1.0f});
-  pipeline_builder.set_scissor({{0, 0}, m_window_extend});
   pipeline_builder.set_rasterizer_info(
       vkinit::rasterization_state_create_info(VK_POLYGON_MODE_FILL));
   pipeline_builder.set_multisampling_info(
@@ -221,302 +750,1105 @@ void VulkanEngine::init_pipelines()
   pipeline_builder.set_color_blend_attachment_state(
       vkinit::color_blench_attachment_state());
   pipeline_builder.set_pipeline_layout(m_triangle_pipeline_layout);
-  // Build pipelines
-  m_triangle_pipeline =
-      pipeline_builder.build_pipeline(m_device, m_render_pass);
+  // Only used with dynamic rendering, m_render_pass is null then
+  pipeline_builder.set_rendering_formats(m_main_formats);
+  // Queue every pipeline and compile them all at once, spread over the
+  // available cores. Each color mode is a variant of the same shaders
+  std::vector<std::pair<SpecializationConstants, PipelineBuilder::Handle>>
+      triangle_handles, mesh_handles;
+  for (auto const* constants : {&vertex_color_variant(), &red_variant()}) {
+    pipeline_builder.set_specialization(*constants);
+    triangle_handles.emplace_back(*constants,
+                                  pipeline_builder.enqueue(m_render_pass));
+  }
 
   pipeline_builder.clear_shaders();
 
   pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
-      VK_SHADER_STAGE_VERTEX_BIT, red_vert_shader));
+      VK_SHADER_STAGE_VERTEX_BIT, mesh_vert_shader));
   pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
-      VK_SHADER_STAGE_FRAGMENT_BIT, red_frag_shader));
-  m_red_triangle_pipeline =
-      pipeline_builder.build_pipeline(m_device, m_render_pass);
-
-  vkDestroyShaderModule(m_device, frag_shader, nullptr);
-  vkDestroyShaderModule(m_device, vert_shader, nullptr);
-  vkDestroyShaderModule(m_device, red_frag_shader, nullptr);
-  vkDestroyShaderModule(m_device, red_vert_shader, nullptr);
-
-  m_main_deletion_queue.push([=] {
-    vkDestroyPipelineLayout(m_device, m_triangle_pipeline_layout, nullptr);
-    vkDestroyPipeline(m_device, m_triangle_pipeline, nullptr);
-    vkDestroyPipeline(m_device, m_red_triangle_pipeline, nullptr);
-  });
+      VK_SHADER_STAGE_FRAGMENT_BIT, frag_shader));
+  pipeline_builder.set_vertex_input(Vertex::get_packed_vertex_description());
+  pipeline_builder.set_pipeline_layout(m_mesh_pipeline_layout);
+  for (auto const* constants : {&vertex_color_variant(), &red_variant()}) {
+    pipeline_builder.set_specialization(*constants);
+    mesh_handles.emplace_back(*constants,
+                              pipeline_builder.enqueue(m_render_pass));
+  }
+
+  // Particles are drawn as points straight from the simulation output
+  PipelineBuilder::Handle particle_handle{};
+  VkShaderModule particle_vert_shader = VK_NULL_HANDLE;
+  VkShaderModule particle_comp_shader = VK_NULL_HANDLE;
+  if (m_config.particle_count != 0) {
+    if (!load_shader_module("shaders/particles.vert.spv",
+                            &particle_vert_shader)
+        || !load_shader_module("shaders/particles.comp.spv",
+                               &particle_comp_shader)) {
+      std::cerr << "Error loading particle shaders\n";
+    }
+    auto particle_layout_info = vkinit::pipeline_layout_create_info(
+        {&m_particle_render_set_layout, 1});
+    vk_check(vkCreatePipelineLayout(m_device, &particle_layout_info, nullptr,
+                                    &m_particle_pipeline_layout));
+
+    pipeline_builder.clear_shaders();
+    pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
+        VK_SHADER_STAGE_VERTEX_BIT, particle_vert_shader));
+    pipeline_builder.push_back(vkinit::pipeline_shader_stage_create_info(
+        VK_SHADER_STAGE_FRAGMENT_BIT, frag_shader));
+    pipeline_builder.set_vertex_input({});
+    pipeline_builder.set_input_assembly_info(
+        vkinit::init_assembly_create_info(VK_PRIMITIVE_TOPOLOGY_POINT_LIST));
+    pipeline_builder.set_pipeline_layout(m_particle_pipeline_layout);
+    pipeline_builder.set_specialization(vertex_color_variant());
+    particle_handle = pipeline_builder.enqueue(m_render_pass);
+
+    auto push_constant = vkinit::push_constant_range(
+        VK_SHADER_STAGE_COMPUTE_BIT, sizeof(ParticlePushConstants));
+    auto compute_layout_info = vkinit::pipeline_layout_create_info(
+        {&m_particle_compute_set_layout, 1}, {&push_constant, 1});
+    vk_check(vkCreatePipelineLayout(m_device, &compute_layout_info, nullptr,
+                                    &m_particle_compute_layout));
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  auto pipelines =
+      pipeline_builder.compile_queued(m_device, m_pipeline_cache);
+  for (auto& [constants, handle] : triangle_handles) {
+    m_triangle_variants[constants] = pipelines[handle].get();
+  }
+  for (auto& [constants, handle] : mesh_handles) {
+    m_mesh_variants[constants] = pipelines[handle].get();
+  }
+  if (m_config.gpu_culling) {
+    VkShaderModule cull_shader;
+    if (!load_shader_module("shaders/cull.comp.spv", &cull_shader)) {
+      std::cerr << "Error loading cull compute shader\n";
+    }
+    auto push_constant = vkinit::push_constant_range(
+        VK_SHADER_STAGE_COMPUTE_BIT, sizeof(CullPushConstants));
+    auto cull_layout_info = vkinit::pipeline_layout_create_info(
+        {&m_cull_set_layout, 1}, {&push_constant, 1});
+    vk_check(vkCreatePipelineLayout(m_device, &cull_layout_info, nullptr,
+                                    &m_cull_pipeline_layout));
+
+    ComputePipelineBuilder compute_builder;
+    compute_builder.set_shader(vkinit::pipeline_shader_stage_create_info(
+        VK_SHADER_STAGE_COMPUTE_BIT, cull_shader));
+    compute_builder.set_pipeline_layout(m_cull_pipeline_layout);
+    m_cull_pipeline =
+        compute_builder.build_pipeline(m_device, m_pipeline_cache);
+    release_shader_module(cull_shader);
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                          m_cull_pipeline_layout);
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE, m_cull_pipeline);
+  }
+  if (m_config.particle_count != 0) {
+    m_particle_pipeline = pipelines[particle_handle].get();
+
+    ComputePipelineBuilder compute_builder;
+    compute_builder.set_shader(vkinit::pipeline_shader_stage_create_info(
+        VK_SHADER_STAGE_COMPUTE_BIT, particle_comp_shader));
+    compute_builder.set_pipeline_layout(m_particle_compute_layout);
+    m_particle_compute_pipeline =
+        compute_builder.build_pipeline(m_device, m_pipeline_cache);
+  }
+  std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cerr << "Pipelines created in " << elapsed.count() << " ms ("
+            << (m_pipeline_cache_warm ? "warm" : "cold") << " cache)\n";
+
+  release_shader_module(frag_shader);
+  release_shader_module(vert_shader);
+  release_shader_module(mesh_vert_shader);
+  if (m_config.particle_count != 0) {
+    release_shader_module(particle_vert_shader);
+    release_shader_module(particle_comp_shader);
+  }
+
+  create_material(m_mesh_variants.at(vertex_color_variant()),
+                  m_mesh_pipeline_layout, "default");
+  create_material(m_mesh_variants.at(red_variant()), m_mesh_pipeline_layout,
+                  "red");
+
+  m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                        m_triangle_pipeline_layout);
+  m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_LAYOUT, m_mesh_pipeline_layout);
+  for (auto& [constants, pipeline] : m_triangle_variants) {
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE, pipeline);
+  }
+  for (auto& [constants, pipeline] : m_mesh_variants) {
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE, pipeline);
+  }
+  if (m_config.particle_count != 0) {
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                          m_particle_pipeline_layout);
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE_LAYOUT,
+                          m_particle_compute_layout);
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE, m_particle_pipeline);
+    m_deletion_queue.push(VK_OBJECT_TYPE_PIPELINE,
+                          m_particle_compute_pipeline);
+  }
+}
+
+void VulkanEngine::load_meshes()
+{
+  TRACE_SCOPE("load_meshes");
+  Mesh triangle_mesh;
+  triangle_mesh.vertices = {
+      {{1.f, 1.f, 0.f}, {0.f, 0.f, 1.f}, {1.f, 1.f, 1.f}},
+      {{-1.f, 1.f, 0.f}, {0.f, 0.f, 1.f}, {1.f, 1.f, 1.f}},
+      {{0.f, -1.f, 0.f}, {0.f, 0.f, 1.f}, {1.f, 1.f, 1.f}},
+  };
+  triangle_mesh.indices = {0, 1, 2};
+  triangle_mesh.upload(m_uploads);
+  m_meshes["triangle"] = std::move(triangle_mesh);
+  if (!m_config.mesh_path.empty()) {
+    auto start = std::chrono::steady_clock::now();
+    MeshFile file;
+    if (!file.open(m_config.mesh_path)) {
+      std::abort();
+    }
+    Mesh mesh;
+    mesh.load(file, m_uploads);
+    Milliseconds elapsed = std::chrono::steady_clock::now() - start;
+    std::cerr << "loaded " << m_config.mesh_path << ": "
+              << file.header().vertex_count << " vertices, "
+              << file.header().index_count / 3 << " triangles, "
+              << file.header().meshlet_count << " meshlets in "
+              << elapsed.count() << " ms\n";
+    m_meshes["model"] = std::move(mesh);
+  }
+  // One submission for every mesh, the first frame waits on it
+  m_uploads.submit();
+
+  for (auto& [name, mesh] : m_meshes) {
+    m_deletion_queue.push(mesh.vertex_buffer.buffer);
+    m_deletion_queue.push(mesh.index_buffer.buffer);
+  }
+}
+
+void VulkanEngine::init_scene()
+{
+  TRACE_SCOPE("init_scene");
+  // A grid of small triangles, or models, tinted by their position. Without
+  // a camera the transforms are directly in clip space
+  constexpr int grid_size = 32;
+  constexpr float cell    = 2.f / grid_size;
+  auto* mesh              = get_mesh("triangle");
+  auto* material          = get_material("default");
+  glm::mat4 cell_transform{1.f};
+  cell_transform[0][0] = cell * 0.4f;
+  cell_transform[1][1] = cell * 0.4f;
+  cell_transform[2][2] = cell * 0.4f;
+  if (!m_config.mesh_path.empty()) {
+    // Fit the bounding sphere of the model in a cell
+    mesh           = get_mesh("model");
+    cell_transform = mesh->fit_transform(cell * 0.4f);
+  }
+  for (int y = 0; y < grid_size; ++y) {
+    for (int x = 0; x < grid_size; ++x) {
+      glm::mat4 transform = cell_transform;
+      transform[3] += glm::vec4{-1.f + cell * (x + 0.5f),
+                                -1.f + cell * (y + 0.5f), 0.f, 0.f};
+      glm::vec4 color{static_cast<float>(x) / grid_size,
+                      static_cast<float>(y) / grid_size, 0.5f, 1.f};
+      add_renderable({mesh, material, transform, color});
+    }
+  }
+}
+
+Material* VulkanEngine::create_material(VkPipeline pipeline,
+                                        VkPipelineLayout layout,
+                                        std::string const& name)
+{
+  auto& material = m_materials[name];
+  material       = {pipeline, layout};
+  return &material;
+}
+
+Material* VulkanEngine::get_material(std::string const& name)
+{
+  auto it = m_materials.find(name);
+  return it == m_materials.end() ? nullptr : &it->second;
+}
+
+Mesh* VulkanEngine::get_mesh(std::string const& name)
+{
+  auto it = m_meshes.find(name);
+  return it == m_meshes.end() ? nullptr : &it->second;
+}
+
+void VulkanEngine::add_renderable(RenderObject const& object)
+{
+  m_renderables.push_back(object);
+  ++m_scene_version;
+}
+
+void VulkanEngine::clear_renderables()
+{
+  m_renderables.clear();
+  ++m_scene_version;
+}
+
+void VulkanEngine::set_camera(glm::mat4 const& view_projection)
+{
+  m_view_projection = view_projection;
+}
+
+void VulkanEngine::select_shader(int shader)
+{
+  m_selected_shader = shader;
+}
+
+FrameStats const& VulkanEngine::last_frame_stats() const
+{
+  return m_frame_stats;
+}
+
+void VulkanEngine::build_draw_batches(FrameData& frame)
+{
+  // The order and the instance data only change with the renderables, a
+  // static scene costs nothing per object and per frame
+  if (m_batches_version != m_scene_version) {
+    m_draw_order.clear();
+    m_draw_batches.clear();
+    for (auto const& object : m_renderables) {
+      m_draw_order.push_back(&object);
+    }
+    // Objects sharing a material and a mesh end up next to each other, so
+    // each group is a contiguous range of instances
+    if (m_config.batch_draws) {
+      std::sort(m_draw_order.begin(), m_draw_order.end(),
+                [](RenderObject const* a, RenderObject const* b) {
+                  return std::tie(a->material, a->mesh)
+                         < std::tie(b->material, b->mesh);
+                });
+    }
+    if (m_draw_order.size() > m_config.max_instances) {
+      std::cerr << m_draw_order.size() << " renderables exceed the "
+                << m_config.max_instances << " instances limit\n";
+      m_draw_order.resize(m_config.max_instances);
+    }
+    m_draw_instance_count = static_cast<uint32_t>(m_draw_order.size());
+    for (uint32_t i = 0; i < m_draw_order.size(); ++i) {
+      auto const* object = m_draw_order[i];
+      if (!m_config.batch_draws || m_draw_batches.empty()
+          || m_draw_batches.back().mesh != object->mesh
+          || m_draw_batches.back().material != object->material) {
+        m_draw_batches.push_back({object->mesh, object->material, i, 0});
+      }
+      ++m_draw_batches.back().instance_count;
+    }
+    m_batches_version = m_scene_version;
+  }
+
+  if (frame.scene_version != m_scene_version) {
+    auto* instances = reinterpret_cast<GPUInstanceData*>(
+        frame.instance_buffer.allocation.mapped);
+    for (uint32_t i = 0; i < m_draw_order.size(); ++i) {
+      instances[i] = {m_draw_order[i]->transform, m_draw_order[i]->color};
+    }
+    if (m_config.gpu_culling) {
+      auto* bounds = reinterpret_cast<GPUObjectBounds*>(
+          frame.bounds_buffer.allocation.mapped);
+      for (uint32_t draw = 0; draw < m_draw_batches.size(); ++draw) {
+        auto const& batch = m_draw_batches[draw];
+        for (uint32_t i = batch.first_instance;
+             i < batch.first_instance + batch.instance_count; ++i) {
+          // The scale of the largest axis bounds the radius
+          auto const& model = m_draw_order[i]->transform;
+          glm::vec4 sphere  = batch.mesh->bounds;
+          float scale = std::max({glm::length(glm::vec3{model[0]}),
+                                  glm::length(glm::vec3{model[1]}),
+                                  glm::length(glm::vec3{model[2]})});
+          glm::vec4 center = model * glm::vec4{glm::vec3{sphere}, 1.f};
+          bounds[i]        = {{glm::vec3{center}, sphere.w * scale}, draw, {}};
+        }
+      }
+    }
+    if (!m_draw_order.empty()) {
+      m_allocator.flush(frame.instance_buffer.allocation, 0,
+                        sizeof(GPUInstanceData) * m_draw_order.size());
+      if (m_config.gpu_culling) {
+        m_allocator.flush(frame.bounds_buffer.allocation, 0,
+                          sizeof(GPUObjectBounds) * m_draw_order.size());
+      }
+    }
+    frame.scene_version = m_scene_version;
+  }
+
+  if (m_config.gpu_culling && !m_draw_batches.empty()) {
+    // The culling pass counts the visible instances of every draw
+    auto* draws = reinterpret_cast<VkDrawIndexedIndirectCommand*>(
+        frame.draw_command_buffer.allocation.mapped);
+    for (uint32_t draw = 0; draw < m_draw_batches.size(); ++draw) {
+      auto const& batch = m_draw_batches[draw];
+      draws[draw] = {batch.mesh->index_buffer.count, 0, 0, 0,
+                     batch.first_instance};
+    }
+    m_allocator.flush(frame.draw_command_buffer.allocation, 0,
+                      sizeof(VkDrawIndexedIndirectCommand)
+                          * m_draw_batches.size());
+  }
+}
+
+void VulkanEngine::record_culling(VkCommandBuffer cmd, FrameData const& frame)
+{
+  if (m_draw_instance_count == 0) {
+    return;
+  }
+  CullPushConstants constants{frustum_planes(m_view_projection),
+                              m_draw_instance_count};
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_cull_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_cull_pipeline_layout, 0, 1, &frame.cull_descriptor,
+                          0, nullptr);
+  vkCmdPushConstants(cmd, m_cull_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                     0, sizeof(constants), &constants);
+  vkCmdDispatch(cmd,
+                (m_draw_instance_count + cull_group_size - 1)
+                    / cull_group_size,
+                1, 1);
+  // The draws read the instance counts, and the vertex shaders the ids
+  VkMemoryBarrier barrier{};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext         = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT
+                           | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VulkanEngine::draw_objects(VkCommandBuffer cmd, FrameData const& frame,
+                                uint32_t first_instance,
+                                uint32_t last_instance)
+{
+  VkDescriptorSet descriptors[] = {m_config.gpu_culling
+                                       ? frame.culled_instance_descriptor
+                                       : frame.instance_descriptor,
+                                   m_frame_descriptor};
+  Material const* last_material = nullptr;
+  Mesh const* last_mesh         = nullptr;
+  for (uint32_t draw = 0; draw < m_draw_batches.size(); ++draw) {
+    auto const& batch = m_draw_batches[draw];
+    // Batches are in instance order, clip them to the requested range. The
+    // instance count of a culled batch is only known to the GPU, it is drawn
+    // whole with the range holding its first instance
+    auto begin = std::max(batch.first_instance, first_instance);
+    auto end = std::min(batch.first_instance + batch.instance_count,
+                        last_instance);
+    if (m_config.gpu_culling ? (batch.first_instance < first_instance
+                                || batch.first_instance >= last_instance)
+                             : begin >= end) {
+      continue;
+    }
+    if (batch.material != last_material) {
+      vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                        batch.material->pipeline);
+      vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              batch.material->pipeline_layout, 0, 2,
+                              descriptors, 1, &frame.uniform_offset);
+      last_material = batch.material;
+    }
+    if (batch.mesh != last_mesh) {
+      batch.mesh->bind(cmd);
+      last_mesh = batch.mesh;
+    }
+    if (m_config.gpu_culling) {
+      vkCmdDrawIndexedIndirect(cmd, frame.draw_command_buffer.buffer,
+                               sizeof(VkDrawIndexedIndirectCommand) * draw, 1,
+                               sizeof(VkDrawIndexedIndirectCommand));
+    } else {
+      vkCmdDrawIndexed(cmd, batch.mesh->index_buffer.count, end - begin, 0, 0,
+                       begin);
+    }
+  }
+}
+
+void VulkanEngine::record_objects_parallel(VkCommandBuffer cmd,
+                                           FrameData& frame,
+                                           VkFramebuffer framebuffer)
+{
+  // Split on instances rather than on batches, a scene made of one mesh
+  // still spreads over every worker
+  const auto job_count = static_cast<uint32_t>(frame.worker_command_pools.size());
+  auto inheritance_info =
+      vkinit::command_buffer_inheritance_info(m_render_pass, 0, framebuffer);
+  // With dynamic rendering the attachment formats stand for the render pass
+  VkCommandBufferInheritanceRenderingInfoKHR rendering_info{};
+  if (m_dynamic_rendering) {
+    rendering_info.sType =
+        VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+    rendering_info.pNext = nullptr;
+    rendering_info.colorAttachmentCount =
+        static_cast<uint32_t>(m_main_formats.color.size());
+    rendering_info.pColorAttachmentFormats = m_main_formats.color.data();
+    rendering_info.depthAttachmentFormat   = m_main_formats.depth;
+    rendering_info.rasterizationSamples    = VK_SAMPLE_COUNT_1_BIT;
+    inheritance_info.pNext                 = &rendering_info;
+  }
+  for (uint32_t job = 0; job < job_count; ++job) {
+    uint32_t first_instance = m_draw_instance_count * job / job_count;
+    uint32_t last_instance  = m_draw_instance_count * (job + 1) / job_count;
+    m_jobs.submit([this, &frame, &inheritance_info, first_instance,
+                   last_instance, job, job_count](uint32_t) {
+      TRACE_SCOPE("record_secondary");
+      // Job i always records into pool i, so a pool is never used by two
+      // threads at once whichever worker picks the job up
+      vk_check(vkResetCommandPool(m_device, frame.worker_command_pools[job], 0));
+      auto secondary = frame.worker_command_buffers[job];
+      auto begin_info = vkinit::command_buffer_begin_info(
+          VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+          | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+      begin_info.pInheritanceInfo = &inheritance_info;
+      vk_check(vkBeginCommandBuffer(secondary, &begin_info));
+      // Dynamic state is not inherited from the primary command buffer
+      VkViewport viewport{0.0f,
+                          0.0f,
+                          static_cast<float>(m_window_extend.width),
+                          static_cast<float>(m_window_extend.height),
+                          0.0f,
+                          1.0f};
+      VkRect2D scissor{{0, 0}, m_window_extend};
+      vkCmdSetViewport(secondary, 0, 1, &viewport);
+      vkCmdSetScissor(secondary, 0, 1, &scissor);
+      draw_objects(secondary, frame, first_instance, last_instance);
+      if (job == job_count - 1) {
+        draw_particles(secondary, frame);
+      }
+      vk_check(vkEndCommandBuffer(secondary));
+    });
+  }
+  m_jobs.wait();
+  vkCmdExecuteCommands(cmd, job_count, frame.worker_command_buffers.data());
+}
+
+void VulkanEngine::submit_simulation(FrameData& frame)
+{
+  TRACE_SCOPE("simulate");
+  // Clamped, so a stall does not send every particle through the walls
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<float> elapsed = now - m_last_simulation_time;
+  m_last_simulation_time = now;
+  ParticlePushConstants constants{std::min(elapsed.count(), 1.f / 30.f),
+                                  m_config.particle_count};
+
+  auto cmd = frame.compute_command_buffer;
+  vk_check(vkResetCommandBuffer(cmd, 0));
+  auto cb_info = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vk_check(vkBeginCommandBuffer(cmd, &cb_info));
+  // The previous step, earlier on this queue, wrote the input. It also read
+  // the buffer written now, which the graphics frame that last used it is
+  // done with since its fence was waited on
+  VkMemoryBarrier barrier{};
+  barrier.sType         = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext         = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier,
+                       0, nullptr, 0, nullptr);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    m_particle_compute_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          m_particle_compute_layout, 0, 1,
+                          &frame.particle_compute_descriptor, 0, nullptr);
+  vkCmdPushConstants(cmd, m_particle_compute_layout,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                     &constants);
+  vkCmdDispatch(cmd,
+                (m_config.particle_count + particle_group_size - 1)
+                    / particle_group_size,
+                1, 1);
+  vk_check(vkEndCommandBuffer(cmd));
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext                = nullptr;
+  submit_info.waitSemaphoreCount   = 0;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores    = &frame.compute_semaphore;
+  submit_info.commandBufferCount   = 1;
+  submit_info.pCommandBuffers      = &cmd;
+  vk_check(vkQueueSubmit(m_compute_queue, 1, &submit_info, VK_NULL_HANDLE));
 }
 
-void VulkanEngine::init()
+void VulkanEngine::draw_particles(VkCommandBuffer cmd, FrameData const& frame)
 {
-  SDL_Init(SDL_INIT_VIDEO);
-  auto window_flags = static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN);
-  m_window          = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_CENTERED,
-                                       SDL_WINDOWPOS_CENTERED, m_window_extend.width,
-                                       m_window_extend.height, window_flags);
-  if (m_window == nullptr) {
-    std::cerr << "failed to create SDL Vulkan Window, SDL Error: "
-              << SDL_GetError() << '\n';
+  if (m_particle_pipeline == VK_NULL_HANDLE) {
+    return;
+  }
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_particle_pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                          m_particle_pipeline_layout, 0, 1,
+                          &frame.particle_render_descriptor, 0, nullptr);
+  vkCmdDraw(cmd, m_config.particle_count, 1, 0, 0);
+}
+
+FrameData& VulkanEngine::get_current_frame()
+{
+  return m_frames[m_frame_number % m_frames.size()];
+}
+
+void VulkanEngine::init(EngineConfig const& config)
+{
+  m_config     = config;
+  m_start_time = std::chrono::steady_clock::now();
+  m_frames = std::vector<FrameData>(std::max(m_config.frames_in_flight, 1u));
+  if (m_config.parallel_recording) {
+    m_jobs.init(m_config.recording_threads != 0
+                    ? m_config.recording_threads
+                    : std::thread::hardware_concurrency());
+  }
+
+  if (!m_config.headless) {
+    SDL_Init(SDL_INIT_VIDEO);
+    auto window_flags =
+        static_cast<SDL_WindowFlags>(SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
+    m_window = SDL_CreateWindow("Vulkan Engine", SDL_WINDOWPOS_CENTERED,
+                                SDL_WINDOWPOS_CENTERED, m_window_extend.width,
+                                m_window_extend.height, window_flags);
+    if (m_window == nullptr) {
+      std::cerr << "failed to create SDL Vulkan Window, SDL Error: "
+                << SDL_GetError() << '\n';
+    }
   }
   init_vulkan();
   init_swapchain();
   init_commands();
-  init_default_renderpass();
-  init_framebuffers();
+  init_render_graph();
   init_sync_structures();
+  init_pipeline_cache();
+  init_descriptors();
+  init_particles();
   init_pipelines();
+  load_meshes();
+  init_scene();
   m_is_initialized = true;
 }
 
-void VulkanEngine::draw()
+void VulkanEngine::record_frame(FrameData& frame, uint32_t image_index)
 {
-  // Wait until the GPU has finished, with a 1s timeout and reset the fence
-  vk_check(vkWaitForFences(m_device, 1, &m_render_fence, true, 1'000'000'000));
-  vk_check(vkResetFences(m_device, 1, &m_render_fence));
-  // Request the image from the swapchain with a 1s timeout
-  std::uint32_t swapchain_image_index;
-  vk_check(vkAcquireNextImageKHR(m_device, m_swapchain, 1'000'000'000,
-                                 m_present_semaphore, nullptr,
-                                 &swapchain_image_index));
+  TRACE_SCOPE("record");
+  auto cmd = frame.main_command_buffer;
   // Reset the command buffer
-  vk_check(vkResetCommandBuffer(m_main_command_buffer, 0));
+  vk_check(vkResetCommandBuffer(cmd, 0));
   // Begin the command buffer recording. We'll use the buffer exactly once
-  VkCommandBufferBeginInfo cb_info{};
-  cb_info.sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-  cb_info.pNext            = nullptr;
-  cb_info.pInheritanceInfo = nullptr;
-  cb_info.flags            = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
-  vk_check(vkBeginCommandBuffer(m_main_command_buffer, &cb_info));
+  auto cb_info = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vk_check(vkBeginCommandBuffer(cmd, &cb_info));
+  m_gpu_profiler.begin_frame(cmd, m_frame_number % m_frames.size());
   // Make some color
   VkClearValue clear_value;
   float flash       = std::abs(std::sin(m_frame_number / 120.f));
   clear_value.color = {{0.0f, 0.0f, flash, 1.0f}};
-  // Start the main render pass
-  VkRenderPassBeginInfo rp_info{};
-  rp_info.sType               = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-  rp_info.pNext               = nullptr;
-  rp_info.renderPass          = m_render_pass;
-  rp_info.renderArea.offset.x = 0;
-  rp_info.renderArea.offset.y = 0;
-  rp_info.renderArea.extent   = m_window_extend;
-  rp_info.framebuffer         = m_frame_buffers[swapchain_image_index];
-  rp_info.clearValueCount     = 1;
-  rp_info.pClearValues        = &clear_value;
-  vkCmdBeginRenderPass(m_main_command_buffer, &rp_info,
-                       VK_SUBPASS_CONTENTS_INLINE);
-
-  // Render stuff
-  if (m_selected_shader == 0) {
-    vkCmdBindPipeline(m_main_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_triangle_pipeline);
-  } else {
-    vkCmdBindPipeline(m_main_command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                      m_red_triangle_pipeline);
+  // This frame's partition is free, its last user has completed
+  m_uniforms.begin_frame(m_frame_number % m_frames.size());
+  std::chrono::duration<float> time =
+      std::chrono::steady_clock::now() - m_start_time;
+  frame.uniform_offset = m_uniforms.push(
+      GPUFrameData{m_view_projection, {time.count(), flash, 0.f, 0.f}});
+  // The instanced draws may come from secondary command buffers, in which
+  // case the primary must not record any draw in the subpass itself
+  const bool draw_instanced = m_selected_shader == 2;
+  const bool secondary = draw_instanced && m_config.parallel_recording;
+  if (draw_instanced) {
+    build_draw_batches(frame);
+    if (m_config.gpu_culling) {
+      m_gpu_profiler.begin_scope(cmd, "cull");
+      record_culling(cmd, frame);
+      m_gpu_profiler.end_scope(cmd);
+    }
   }
-  vkCmdDraw(m_main_command_buffer, 3, 1, 0, 0);
-
-  // End the main render pass and the command buffer;
-  vkCmdEndRenderPass(m_main_command_buffer);
-  vk_check(vkEndCommandBuffer(m_main_command_buffer));
-  // Submit the command buffer to the command queue
-  VkPipelineStageFlags wait_stage =
-      VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-  VkSubmitInfo submit_info{};
-  submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-  submit_info.pNext                = nullptr;
-  submit_info.pWaitDstStageMask    = &wait_stage;
-  submit_info.waitSemaphoreCount   = 1;
-  submit_info.pWaitSemaphores      = &m_present_semaphore;
-  submit_info.signalSemaphoreCount = 1;
-  submit_info.pSignalSemaphores    = &m_render_semaphore;
-  submit_info.commandBufferCount   = 1;
-  submit_info.pCommandBuffers      = &m_main_command_buffer;
-  vk_check(vkQueueSubmit(m_graphics_queue, 1, &submit_info, m_render_fence));
-  // Display the image to the screen
-  VkPresentInfoKHR present_info{};
-  present_info.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-  present_info.pNext              = nullptr;
-  present_info.swapchainCount     = 1;
-  present_info.pSwapchains        = &m_swapchain;
-  present_info.waitSemaphoreCount = 1;
-  present_info.pWaitSemaphores    = &m_render_semaphore;
-  present_info.pImageIndices      = &swapchain_image_index;
-  vk_check(vkQueuePresentKHR(m_graphics_queue, &present_info));
-  ++m_frame_number;
+  m_render_graph.set_image(m_backbuffer, m_swapchain_images[image_index],
+                           m_swapchain_image_views[image_index]);
+  m_render_graph.set_clear_value(m_main_pass, m_backbuffer, clear_value);
+  m_render_graph.set_subpass_contents(
+      m_main_pass, secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                             : VK_SUBPASS_CONTENTS_INLINE);
+  m_render_graph.execute(cmd, &m_gpu_profiler);
+  vk_check(vkEndCommandBuffer(cmd));
+  m_uniforms.flush();
 }
 
-void VulkanEngine::run()
+void VulkanEngine::record_capture(VkCommandBuffer cmd)
 {
-  SDL_Event e;
-  bool run = true;
-  while (run) {
-    while (SDL_PollEvent(&e) != 0) {
-      if (e.type == SDL_QUIT) {
-        run = false;
-      } else if (e.type == SDL_KEYDOWN) {
-        if (e.key.keysym.sym == SDLK_SPACE) {
-          std::cerr << "switch shader\n";
-          m_selected_shader =
-              m_selected_shader == 1 ? 0 : m_selected_shader + 1;
-        }
-      }
-    }
-    draw();
+  if (m_frame_number % std::max(m_config.capture_interval, 1u) != 0) {
+    return;
   }
+  // The writer thread takes it from there once the frame has completed
+  m_capture.record(cmd, m_render_graph.image(m_backbuffer), m_window_extend,
+                   m_swapchain_image_format, m_frame_number);
 }
 
-void VulkanEngine::cleanup()
+void VulkanEngine::record_main_pass(VkCommandBuffer cmd,
+                                    RenderGraph::PassContext const& context)
 {
-  if (m_is_initialized) {
-    vkWaitForFences(m_device, 1, &m_render_fence, true, 1'000'000);
-    m_main_deletion_queue.flush();
-    vkDestroyDevice(m_device, nullptr);
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
-    vkb::destroy_debug_utils_messenger(m_instance, m_debug_messenger);
-    vkDestroyInstance(m_instance, nullptr);
-    SDL_DestroyWindow(m_window);
+  auto& frame = get_current_frame();
+  const bool draw_instanced = m_selected_shader == 2;
+  const bool secondary = draw_instanced && m_config.parallel_recording;
+  // Render stuff
+  VkViewport viewport{0.0f,
+                      0.0f,
+                      static_cast<float>(context.extent.width),
+                      static_cast<float>(context.extent.height),
+                      0.0f,
+                      1.0f};
+  VkRect2D scissor{{0, 0}, context.extent};
+  if (!secondary) {
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+  }
+  if (secondary) {
+    // Only vkCmdExecuteCommands is allowed in the subpass, the render pass
+    // scope covers the secondary command buffers
+    record_objects_parallel(cmd, frame, context.framebuffer);
+  } else if (draw_instanced) {
+    m_gpu_profiler.begin_scope(cmd, "instanced");
+    draw_objects(cmd, frame, 0, m_draw_instance_count);
+    m_gpu_profiler.end_scope(cmd);
+  } else {
+    m_gpu_profiler.begin_scope(cmd, m_selected_shader == 0 ? "triangle"
+                                                           : "red_triangle");
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      m_triangle_variants.at(m_selected_shader == 0
+                                                 ? vertex_color_variant()
+                                                 : red_variant()));
+    vkCmdDraw(cmd, 3, 1, 0, 0);
+    m_gpu_profiler.end_scope(cmd);
+  }
+  if (!secondary && m_particle_pipeline != VK_NULL_HANDLE) {
+    m_gpu_profiler.begin_scope(cmd, "particles");
+    draw_particles(cmd, frame);
+    m_gpu_profiler.end_scope(cmd);
   }
 }
 
-bool VulkanEngine::load_shader_module(std::filesystem::path const& file_path,
-                                      VkShaderModule* out_shader_module)
+void VulkanEngine::draw()
 {
-  std::ifstream file{file_path, std::ios::ate | std::ios::binary};
-  if (!file.is_open()) {
-    std::cerr << file_path << " not found\n";
-    return false;
+  TRACE_SCOPE("draw");
+  auto& frame = get_current_frame();
+  auto cmd    = frame.main_command_buffer;
+  if (!m_input_sampled) {
+    m_input_time = std::chrono::steady_clock::now();
   }
-  std::size_t file_size = file.tellg();
-  std::vector<uint32_t> buffer;
-  buffer.resize(file_size / sizeof(uint32_t));
-  file.seekg(0);
-  file.read(reinterpret_cast<char*>(buffer.data()), file_size);
-
-  // Create a new shader module
-  VkShaderModuleCreateInfo create_info{};
-  create_info.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-  create_info.pNext    = nullptr;
-  create_info.codeSize = buffer.size() * sizeof(uint32_t);
-  create_info.pCode    = buffer.data();
-
-  VkShaderModule shader_module;
-  if (vkCreateShaderModule(m_device, &create_info, nullptr, &shader_module)
-      != VK_SUCCESS) {
-    return false;
+  // Wait until the GPU has finished the last use of this frame's resources,
+  // with a 1s timeout
+  auto wait_start = std::chrono::steady_clock::now();
+  wait_frame_fence(frame);
+  m_frame_stats.fence_wait_ms =
+      Milliseconds{std::chrono::steady_clock::now() - wait_start}.count();
+  m_frame_stats.acquire_ms = 0.0;
+  // Every frame up to the previous use of this frame's slot has completed
+  const auto frames_in_flight = static_cast<int>(m_frames.size());
+  if (m_frame_number + 1 >= frames_in_flight) {
+    m_deletion_queue.collect(m_frame_number + 1 - frames_in_flight);
+    if (m_capturing) {
+      m_capture.collect(m_frame_number + 1 - frames_in_flight);
+    }
   }
-  *out_shader_module = shader_module;
-  return true;
-}
-
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkRenderPass pass)
-{
-  VkPipelineViewportStateCreateInfo viewport_state{};
-  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-  viewport_state.pNext = nullptr;
-  viewport_state.viewportCount = 1;
-  viewport_state.pViewports    = &m_viewport;
-  viewport_state.scissorCount  = 1;
-  viewport_state.pScissors     = &m_scissor;
-
-  VkPipelineColorBlendStateCreateInfo color_blending{};
-  color_blending.sType =
-      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-  color_blending.pNext           = nullptr;
-  color_blending.logicOpEnable   = VK_FALSE;
-  color_blending.logicOp         = VK_LOGIC_OP_COPY;
-  color_blending.attachmentCount = 1;
-  color_blending.pAttachments    = &m_color_blend_attachment;
-
-  VkGraphicsPipelineCreateInfo pipeline_info{};
-  pipeline_info.sType      = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-  pipeline_info.pNext      = nullptr;
-  pipeline_info.stageCount = m_shader_stages.size();
-  pipeline_info.pStages    = m_shader_stages.data();
-  pipeline_info.pVertexInputState   = &m_vertex_input_info;
-  pipeline_info.pInputAssemblyState = &m_input_assembly;
-  pipeline_info.pViewportState      = &viewport_state;
-  pipeline_info.pRasterizationState = &m_rasterizer;
-  pipeline_info.pMultisampleState   = &m_multisampling;
-  pipeline_info.pColorBlendState    = &color_blending;
-  pipeline_info.layout              = m_pipeline_layout;
-  pipeline_info.renderPass          = pass;
-  pipeline_info.subpass             = 0;
-  pipeline_info.basePipelineHandle  = VK_NULL_HANDLE;
-
-  VkPipeline pipeline;
-  VkResult result = vkCreateGraphicsPipelines(
-      device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &pipeline);
-  if (result == VK_SUCCESS) {
-    return pipeline;
+  // Request the image from the swapchain with a 1s timeout. Offscreen images
+  // are simply cycled through
+  std::uint32_t swapchain_image_index;
+  if (m_config.headless) {
+    swapchain_image_index = m_frame_number % m_swapchain_images.size();
   } else {
-    std::cerr << "failed to create pipeline with error: " << result << '\n';
-    return VK_NULL_HANDLE;
+    VkResult result;
+    auto acquire_start = std::chrono::steady_clock::now();
+    {
+      TRACE_SCOPE("acquire");
+      result = vkAcquireNextImageKHR(m_device, m_swapchain, 1'000'000'000,
+                                     frame.present_semaphore, nullptr,
+                                     &swapchain_image_index);
+    }
+    m_frame_stats.acquire_ms =
+        Milliseconds{std::chrono::steady_clock::now() - acquire_start}.count();
+    if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+      // Nothing has been submitted, the fence is still signaled for the next
+      // attempt
+      recreate_swapchain();
+      return;
+    }
+    if (result != VK_SUBOPTIMAL_KHR) {
+      vk_check(result);
+    } else {
+      // The image is still presentable, render it and resize afterwards
+      m_resize_requested = true;
+    }
+  }
+  vk_check(vkResetFences(m_device, 1, &frame.render_fence));
+  // The image may still be in use by an older frame if the swapchain hands
+  // out images out of order: wait for it and claim the image for this frame
+  auto& image_fence = m_images_in_flight[swapchain_image_index];
+  if (image_fence != VK_NULL_HANDLE && image_fence != frame.render_fence) {
+    wait_start = std::chrono::steady_clock::now();
+    vk_check(vkWaitForFences(m_device, 1, &image_fence, true, 1'000'000'000));
+    m_frame_stats.fence_wait_ms +=
+        Milliseconds{std::chrono::steady_clock::now() - wait_start}.count();
+  }
+  image_fence = frame.render_fence;
+  // The simulation step runs on the compute queue while the frame is being
+  // recorded, and overlaps the rasterization up to the vertex shaders
+  const bool simulate = m_particle_compute_pipeline != VK_NULL_HANDLE;
+  if (simulate) {
+    submit_simulation(frame);
+  }
+  record_frame(frame, swapchain_image_index);
+  // Submit the command buffer to the command queue. Without a swapchain
+  // there is no image to wait on nor to present
+  VkSemaphore wait_semaphores[3];
+  VkPipelineStageFlags wait_stages[3];
+  uint64_t wait_values[3]{};
+  uint32_t wait_count = 0;
+  if (!m_config.headless) {
+    wait_semaphores[wait_count] = frame.present_semaphore;
+    wait_stages[wait_count]     = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    ++wait_count;
+  }
+  if (simulate) {
+    wait_semaphores[wait_count] = frame.compute_semaphore;
+    wait_stages[wait_count]     = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+    ++wait_count;
+  }
+  // Copies queued since the last frame go out in one batch. Every frame
+  // waits on the last batch, waiting on a reached value costs nothing, and a
+  // wait only orders the commands of its own submission
+  m_uploads.submit();
+  if (m_uploads.submitted_value() != 0) {
+    wait_semaphores[wait_count] = m_uploads.semaphore();
+    wait_stages[wait_count] =
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
+        | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT
+        | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    wait_values[wait_count] = m_uploads.submitted_value();
+    ++wait_count;
+  }
+  VkTimelineSemaphoreSubmitInfoKHR timeline_info{};
+  timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_info.pNext = nullptr;
+  timeline_info.waitSemaphoreValueCount = wait_count;
+  timeline_info.pWaitSemaphoreValues    = wait_values;
+  VkSubmitInfo submit_info{};
+  submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext                = &timeline_info;
+  submit_info.pWaitDstStageMask    = wait_stages;
+  submit_info.waitSemaphoreCount   = wait_count;
+  submit_info.pWaitSemaphores      = wait_semaphores;
+  submit_info.signalSemaphoreCount = m_config.headless ? 0 : 1;
+  submit_info.pSignalSemaphores    = &frame.render_semaphore;
+  submit_info.commandBufferCount   = 1;
+  submit_info.pCommandBuffers      = &cmd;
+  {
+    TRACE_SCOPE("submit");
+    vk_check(
+        vkQueueSubmit(m_graphics_queue, 1, &submit_info, frame.render_fence));
+  }
+  frame.submit_time     = std::chrono::steady_clock::now();
+  frame.latency_pending = true;
+  m_frame_stats.input_to_submit_ms =
+      Milliseconds{frame.submit_time - m_input_time}.count();
+  m_input_to_submit_total_ms += m_frame_stats.input_to_submit_ms;
+  ++m_submit_samples;
+  m_input_sampled = false;
+  m_last_image_index = swapchain_image_index;
+  if (!m_config.headless) {
+    // Display the image to the screen
+    VkPresentInfoKHR present_info{};
+    present_info.sType              = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    present_info.pNext              = nullptr;
+    present_info.swapchainCount     = 1;
+    present_info.pSwapchains        = &m_swapchain;
+    present_info.waitSemaphoreCount = 1;
+    present_info.pWaitSemaphores    = &frame.render_semaphore;
+    present_info.pImageIndices      = &swapchain_image_index;
+    VkResult result;
+    {
+      TRACE_SCOPE("present");
+      result = vkQueuePresentKHR(m_graphics_queue, &present_info);
+    }
+    if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+      m_resize_requested = true;
+    } else {
+      vk_check(result);
+    }
+  }
+  ++m_frame_number;
+  if (m_resize_requested) {
+    recreate_swapchain();
   }
 }
 
-void PipelineBuilder::push_back(VkPipelineShaderStageCreateInfo&& shader_stage)
+void VulkanEngine::wait_frame_fence(FrameData& frame)
 {
-  m_shader_stages.push_back(std::move(shader_stage));
+  {
+    TRACE_SCOPE("wait_fence");
+    vk_check(vkWaitForFences(m_device, 1, &frame.render_fence, true,
+                             1'000'000'000));
+  }
+  if (frame.latency_pending) {
+    m_frame_stats.submit_to_present_ms =
+        Milliseconds{std::chrono::steady_clock::now() - frame.submit_time}
+            .count();
+    m_submit_to_present_total_ms += m_frame_stats.submit_to_present_ms;
+    ++m_present_samples;
+    frame.latency_pending = false;
+  }
 }
 
-void PipelineBuilder::set_vertex_input_info(
-    VkPipelineVertexInputStateCreateInfo const& info)
+void VulkanEngine::pace_frame()
 {
-  m_vertex_input_info = info;
+  const auto frames_in_flight = static_cast<uint32_t>(m_frames.size());
+  uint32_t queued = m_config.max_queued_frames;
+  if (queued == 0) {
+    queued = m_config.low_latency ? 1 : frames_in_flight;
+  }
+  queued = std::min(queued, frames_in_flight);
+  if (static_cast<uint32_t>(m_frame_number) < queued) {
+    return;
+  }
+  // Frame N - queued has not been reused yet since queued <= frames in
+  // flight, its fence still tracks it
+  TRACE_SCOPE("pace_frame");
+  wait_frame_fence(m_frames[(m_frame_number - queued) % frames_in_flight]);
 }
 
-void PipelineBuilder::set_input_assembly_info(
-    VkPipelineInputAssemblyStateCreateInfo const& info)
+void VulkanEngine::mark_input_sampled()
 {
-  m_input_assembly = info;
+  m_input_time    = std::chrono::steady_clock::now();
+  m_input_sampled = true;
 }
 
-void PipelineBuilder::set_viewport(VkViewport const& viewport)
+void VulkanEngine::report_latency() const
 {
-  m_viewport = viewport;
+  if (m_submit_samples == 0 || m_present_samples == 0) {
+    return;
+  }
+  std::cerr << "latency ("
+            << (m_config.headless ? "offscreen"
+                                  : present_mode_name(m_present_mode))
+            << "): input to submit "
+            << m_input_to_submit_total_ms / m_submit_samples
+            << " ms, submit to present "
+            << m_submit_to_present_total_ms / m_present_samples
+            << " ms on average\n";
 }
 
-void PipelineBuilder::set_scissor(VkRect2D const& scissor)
+void VulkanEngine::run()
 {
-  m_scissor = scissor;
-}
+  if (m_config.headless) {
+    // Nothing caps the frame rate here, so report the raw throughput
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < m_config.frame_count; ++i) {
+      draw();
+    }
+    vk_check(vkDeviceWaitIdle(m_device));
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cerr << "rendered " << m_config.frame_count << " frames in "
+              << elapsed.count() * 1000.0 << " ms ("
+              << m_config.frame_count / elapsed.count() << " fps)\n";
+    report_latency();
+    return;
+  }
 
-void PipelineBuilder::set_rasterizer_info(
-    VkPipelineRasterizationStateCreateInfo const& info)
-{
-  m_rasterizer = info;
+  SDL_Event e;
+  bool run = true;
+  while (run) {
+    // Sample input only once the GPU has caught up, the frame then reflects
+    // the latest input when it is presented
+    pace_frame();
+    {
+      TRACE_SCOPE("poll_events");
+      while (SDL_PollEvent(&e) != 0) {
+        if (e.type == SDL_QUIT) {
+          run = false;
+        } else if (e.type == SDL_KEYDOWN) {
+          if (e.key.keysym.sym == SDLK_SPACE) {
+            std::cerr << "switch shader\n";
+            m_selected_shader =
+                m_selected_shader == 2 ? 0 : m_selected_shader + 1;
+          }
+        } else if (e.type == SDL_WINDOWEVENT
+                   && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
+          m_resize_requested = true;
+        }
+      }
+      mark_input_sampled();
+    }
+    if (SDL_GetWindowFlags(m_window) & SDL_WINDOW_MINIMIZED) {
+      // Nothing to present to, don't spin
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    if (m_resize_requested) {
+      recreate_swapchain();
+    }
+    draw();
+    if (m_config.frame_count != 0
+        && static_cast<uint32_t>(m_frame_number) >= m_config.frame_count) {
+      run = false;
+    }
+  }
+  report_latency();
 }
 
-void PipelineBuilder::set_color_blend_attachment_state(
-    VkPipelineColorBlendAttachmentState const& state)
+void VulkanEngine::cleanup()
 {
-  m_color_blend_attachment = state;
+  if (m_is_initialized) {
+    for (auto& frame : m_frames) {
+      vkWaitForFences(m_device, 1, &frame.render_fence, true, 1'000'000'000);
+    }
+    if (!m_config.pipeline_cache_path.empty()) {
+      vkutil::save_pipeline_cache(m_device, m_pipeline_cache,
+                                  m_config.pipeline_cache_path);
+    }
+    m_jobs.destroy();
+    m_uploads.destroy();
+    if (m_capturing) {
+      m_capture.destroy();
+      std::cerr << "captured " << m_capture.written_frames() << " frames to "
+                << m_config.capture_directory << ", "
+                << m_capture.dropped_frames() << " dropped\n";
+    }
+    m_gpu_profiler.resolve();
+    if (!m_config.gpu_profile_path.empty()) {
+      m_gpu_profiler.write_report(m_config.gpu_profile_path);
+    }
+    m_gpu_profiler.destroy();
+    if (!m_config.trace_path.empty()) {
+      vktrace::write_chrome_trace(m_config.trace_path);
+    }
+    retire_swapchain();
+    m_render_graph.destroy();
+    m_deletion_queue.flush();
+    m_descriptor_allocator.destroy();
+    m_layout_cache.destroy();
+    m_shader_library.destroy();
+    m_allocator.destroy();
+    vkDestroyDevice(m_device, nullptr);
+    if (m_surface != VK_NULL_HANDLE) {
+      vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
+    }
+    vkb::destroy_debug_utils_messenger(m_instance, m_debug_messenger);
+    vkDestroyInstance(m_instance, nullptr);
+    if (m_window != nullptr) {
+      SDL_DestroyWindow(m_window);
+    }
+  }
 }
 
-void PipelineBuilder::set_multisampling_info(
-    VkPipelineMultisampleStateCreateInfo const& info)
+void VulkanEngine::immediate_submit(
+    std::function<void(VkCommandBuffer)>&& function)
 {
-  m_multisampling = info;
+  auto cmd = m_immediate_command_buffer;
+  auto cb_info = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vk_check(vkBeginCommandBuffer(cmd, &cb_info));
+  function(cmd);
+  vk_check(vkEndCommandBuffer(cmd));
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType              = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext              = nullptr;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers    = &cmd;
+  vk_check(vkQueueSubmit(m_graphics_queue, 1, &submit_info, m_immediate_fence));
+  vk_check(
+      vkWaitForFences(m_device, 1, &m_immediate_fence, true, 9'999'999'999));
+  vk_check(vkResetFences(m_device, 1, &m_immediate_fence));
+  vk_check(vkResetCommandPool(m_device, m_immediate_command_pool, 0));
 }
 
-void PipelineBuilder::set_pipeline_layout(VkPipelineLayout const& layout)
+bool VulkanEngine::read_pixels(std::vector<std::uint8_t>& pixels)
 {
-  m_pipeline_layout = layout;
+  if (!m_config.headless || m_frame_number == 0) {
+    std::cerr << "no offscreen frame to read back\n";
+    return false;
+  }
+  const VkDeviceSize size =
+      VkDeviceSize{m_window_extend.width} * m_window_extend.height * 4;
+
+  auto buffer = m_allocator.create_buffer(
+      size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+      VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+
+  auto image = m_swapchain_images[m_last_image_index];
+  immediate_submit([&](VkCommandBuffer cmd) {
+    // Make the render pass writes visible to the copy
+    VkImageMemoryBarrier barrier{};
+    barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext               = nullptr;
+    barrier.srcAccessMask       = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    barrier.dstAccessMask       = VK_ACCESS_TRANSFER_READ_BIT;
+    barrier.oldLayout           = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image               = image;
+    barrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                         nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset      = 0;
+    region.bufferRowLength   = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource  = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageOffset       = {0, 0, 0};
+    region.imageExtent = {m_window_extend.width, m_window_extend.height, 1};
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           buffer.buffer, 1, &region);
+  });
+
+  pixels.resize(size);
+  std::memcpy(pixels.data(), buffer.allocation.mapped, size);
+  m_allocator.destroy_buffer(buffer);
+  return true;
 }
 
-void PipelineBuilder::clear_shaders()
+bool VulkanEngine::save_frame(std::filesystem::path const& file_path)
 {
-  m_shader_stages.clear();
+  std::vector<std::uint8_t> pixels;
+  if (!read_pixels(pixels)) {
+    return false;
+  }
+  std::ofstream file{file_path, std::ios::binary};
+  if (!file.is_open()) {
+    std::cerr << "failed to open " << file_path << '\n';
+    return false;
+  }
+  // Binary PPM, dropping the alpha channel
+  file << "P6\n"
+       << m_window_extend.width << ' ' << m_window_extend.height << "\n255\n";
+  for (std::size_t i = 0; i < pixels.size(); i += 4) {
+    file.write(reinterpret_cast<char const*>(&pixels[i]), 3);
+  }
+  return file.good();
 }
 
-void DeletionQueue::push(std::function<void()> const& f)
+bool VulkanEngine::load_shader_module(std::filesystem::path const& file_path,
+                                      VkShaderModule* out_shader_module)
 {
-  m_queue.push(f);
+  TRACE_SCOPE("load_shader_module");
+  // Shared with every other user of an identical binary, give it back with
+  // release_shader_module()
+  auto shader_module = m_shader_library.acquire(file_path);
+  if (shader_module == VK_NULL_HANDLE) {
+    return false;
+  }
+  *out_shader_module = shader_module;
+  return true;
 }
 
-void DeletionQueue::flush()
+void VulkanEngine::release_shader_module(VkShaderModule shader_module)
 {
-  while (!m_queue.empty()) {
-    m_queue.front()();
-    m_queue.pop();
-  }
+  m_shader_library.release(shader_module);
 }
@@ -1,105 +1,402 @@
 #ifndef ENGINE_HPP
 #define ENGINE_HPP
 
+#include "vk_capture.hpp"
+#include "vk_deletion_queue.hpp"
+#include "vk_descriptors.hpp"
+#include "vk_jobs.hpp"
+#include "vk_memory.hpp"
+#include "vk_mesh.hpp"
+#include "vk_pipeline.hpp"
+#include "vk_profiler.hpp"
+#include "vk_render_graph.hpp"
+#include "vk_shader.hpp"
 #include "vk_types.hpp"
+#include "vk_uniform.hpp"
+#include "vk_upload.hpp"
 
+#include <glm/glm.hpp>
+
+#include <chrono>
 #include <cinttypes>
 #include <filesystem>
 #include <functional>
-#include <queue>
+#include <map>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
-class DeletionQueue
+struct EngineConfig
 {
-  using Function = std::function<void()>;
-  std::queue<Function> m_queue;
+  // Number of frames the CPU may record ahead of the GPU
+  uint32_t frames_in_flight{2};
+  // Render into engine-owned offscreen images, without window or surface
+  bool headless{false};
+  // Frames rendered by run() before returning, 0 runs until the window is
+  // closed
+  uint32_t frame_count{0};
+  // Pipeline cache loaded at init and written back at cleanup, empty to
+  // disable persistence
+  std::filesystem::path pipeline_cache_path{"pipeline_cache.bin"};
+  // Capacity of the per-frame instance buffer
+  uint32_t max_instances{1 << 16};
+  // Record the instanced draws into secondary command buffers on worker
+  // threads
+  bool parallel_recording{false};
+  // Worker threads used for parallel recording, 0 uses every core
+  uint32_t recording_threads{0};
+  // GPU timings report written at cleanup, CSV or JSON depending on the
+  // extension, empty to disable
+  std::filesystem::path gpu_profile_path;
+  // Chrome trace of the TRACE_SCOPE events written at cleanup, empty to
+  // disable. Requires a build with VKENGINE_ENABLE_TRACING
+  std::filesystem::path trace_path;
+  // Group renderables sharing a material and a mesh into instanced draws.
+  // When false every renderable is its own draw, in submission order
+  bool batch_draws{true};
+  // Present with MAILBOX, or IMMEDIATE, when available instead of FIFO and
+  // pace frames to sample input as late as possible
+  bool low_latency{false};
+  // Frames submitted to the GPU that run() lets queue up before sampling the
+  // input of the next one. 0 for frames_in_flight, or 1 in low latency mode
+  uint32_t max_queued_frames{0};
+  // Particles simulated on the GPU by a compute pass, on the async compute
+  // queue when the device has one, and drawn as points. 0 disables them
+  uint32_t particle_count{0};
+  // Cull the instances against the view frustum in a compute pass and draw
+  // the visible ones with one indirect draw per batch
+  bool gpu_culling{false};
+  // Record the passes with VK_KHR_dynamic_rendering when the device supports
+  // it, with render pass and framebuffer objects otherwise
+  bool dynamic_rendering{true};
+  // Mesh file written by mesh_converter, drawn instead of the triangle.
+  // Empty to draw the triangle
+  std::filesystem::path mesh_path;
+  // Rendered frames copied to host memory and written to this directory by a
+  // background thread, without stalling the rendering. Empty to disable
+  std::filesystem::path capture_directory;
+  CaptureFormat capture_format{CaptureFormat::ppm};
+  // Capture one frame out of capture_interval
+  uint32_t capture_interval{1};
+};
 
- public:
-  void push(Function const& f);
-  void flush();
+// CPU time draw() spent blocked on the GPU or the presentation engine
+struct FrameStats
+{
+  double fence_wait_ms{0.0};
+  double acquire_ms{0.0};
+  // From the input sampled by run(), or the start of draw(), to the submit
+  double input_to_submit_ms{0.0};
+  // From the submit of the last completed frame to its fence signaling, when
+  // the image becomes presentable. An upper bound if the fence was signaled
+  // before being waited on
+  double submit_to_present_ms{0.0};
+};
+
+struct Material
+{
+  VkPipeline pipeline;
+  VkPipelineLayout pipeline_layout;
+};
+
+struct RenderObject
+{
+  Mesh* mesh;
+  Material* material;
+  glm::mat4 transform;
+  glm::vec4 color;
+};
+
+// Per-instance data as laid out in the instance storage buffer (std430)
+struct GPUInstanceData
+{
+  glm::mat4 model;
+  glm::vec4 color;
+};
+
+// A particle as laid out in the particle storage buffers (std430)
+struct GPUParticle
+{
+  glm::vec2 position;
+  glm::vec2 velocity;
+  glm::vec4 color;
+};
+
+// Uniforms shared by every draw of a frame (std140), set 1 of the mesh shaders
+struct GPUFrameData
+{
+  glm::mat4 view_projection;
+  // Seconds since init in x, the clear color flash in y
+  glm::vec4 time;
+};
+
+// Input of the culling pass, one per instance
+struct GPUObjectBounds
+{
+  // Bounding sphere in world space, center in xyz and radius in w
+  glm::vec4 sphere;
+  uint32_t draw_index;
+  uint32_t padding[3];
+};
+
+// Consecutive instances sharing a mesh and a material, drawn with one call
+struct DrawBatch
+{
+  Mesh* mesh;
+  Material* material;
+  uint32_t first_instance;
+  uint32_t instance_count;
+};
+
+struct FrameData
+{
+  VkCommandPool command_pool;
+  VkCommandBuffer main_command_buffer;
+  VkFence render_fence;
+  VkSemaphore present_semaphore;
+  VkSemaphore render_semaphore;
+  std::chrono::steady_clock::time_point submit_time;
+  // Submitted, with submit_to_present not measured yet
+  bool latency_pending{false};
+
+  // Persistently mapped, indexed by the mesh shaders with the instance ids
+  // found at gl_InstanceIndex
+  AllocatedBuffer instance_buffer;
+  VkDescriptorSet instance_descriptor;
+  // Dynamic offset of the frame's GPUFrameData in the uniform ring
+  uint32_t uniform_offset{0};
+  // Scene version the instance data was last written for
+  uint64_t scene_version{~0ull};
+
+  // GPU culling: the instance bounds, one indirect draw per batch and the
+  // ids of the visible instances, compacted per batch
+  AllocatedBuffer bounds_buffer;
+  AllocatedBuffer draw_command_buffer;
+  AllocatedBuffer visible_buffer;
+  VkDescriptorSet cull_descriptor;
+  // Instance set reading the ids through visible_buffer, instance_descriptor
+  // reads them from the identity buffer
+  VkDescriptorSet culled_instance_descriptor;
+
+  // One pool per recording worker, each only ever used by one job at a time
+  std::vector<VkCommandPool> worker_command_pools;
+  std::vector<VkCommandBuffer> worker_command_buffers;
+
+  // Particle simulation step, submitted to the compute queue. The render
+  // submit waits on compute_semaphore before its vertex shaders run
+  VkCommandPool compute_command_pool;
+  VkCommandBuffer compute_command_buffer;
+  VkSemaphore compute_semaphore;
+  // Particles after this frame's step, shared by the compute and graphics
+  // queue families
+  AllocatedBuffer particle_buffer;
+  // Reads the previous frame's particles and writes this frame's ones
+  VkDescriptorSet particle_compute_descriptor;
+  VkDescriptorSet particle_render_descriptor;
 };
 
 class VulkanEngine
 {
   bool m_is_initialized{false};
   int m_frame_number{0};
+  EngineConfig m_config;
   VkExtent2D m_window_extend{1280, 600};
   struct SDL_Window* m_window{nullptr};
 
   VkInstance m_instance;
   VkDebugUtilsMessengerEXT m_debug_messenger;
   VkPhysicalDevice m_chosen_gpu;
+  VkPhysicalDeviceProperties m_gpu_properties;
   VkDevice m_device;
   VkSurfaceKHR m_surface;
   VkSwapchainKHR m_swapchain;
   VkFormat m_swapchain_image_format;
+  VkPresentModeKHR m_present_mode{VK_PRESENT_MODE_FIFO_KHR};
   VkQueue m_graphics_queue;
   uint32_t m_graphics_queue_family;
-  VkCommandPool m_command_pool;
-  VkCommandBuffer m_main_command_buffer;
+  // A queue of a compute only family when the device has one, the graphics
+  // queue otherwise
+  VkQueue m_compute_queue;
+  uint32_t m_compute_queue_family;
+  // A queue of a transfer only family when the device has one, the graphics
+  // queue otherwise
+  VkQueue m_transfer_queue;
+  uint32_t m_transfer_queue_family;
 
   std::vector<VkImage> m_swapchain_images;
   std::vector<VkImageView> m_swapchain_image_views;
+  // Offscreen images standing in for the swapchain in headless mode
+  std::vector<AllocatedImage> m_offscreen_images;
+  uint32_t m_last_image_index{0};
 
+  VkCommandPool m_immediate_command_pool;
+  VkCommandBuffer m_immediate_command_buffer;
+  VkFence m_immediate_fence;
+
+  // Selected at device creation, from the config and the device support
+  bool m_dynamic_rendering{false};
+  PFN_vkCmdBeginRenderingKHR m_cmd_begin_rendering{nullptr};
+  PFN_vkCmdEndRenderingKHR m_cmd_end_rendering{nullptr};
+
+  // The frame's passes. For now a single one drawing into the swapchain
+  // image, whose render pass, or attachment formats, the pipelines are built
+  // against
+  RenderGraph m_render_graph;
+  RenderGraph::Resource m_backbuffer;
+  RenderGraph::Pass m_main_pass;
+  // Copies the backbuffer out for the capture, only in the graph when
+  // capturing
+  RenderGraph::Pass m_capture_pass;
+  bool m_capturing{false};
+  FrameCapture m_capture;
   VkRenderPass m_render_pass;
-  std::vector<VkFramebuffer> m_frame_buffers;
+  RenderingFormats m_main_formats;
+
+  bool m_resize_requested{false};
 
-  VkFence m_render_fence;
-  VkSemaphore m_present_semaphore;
-  VkSemaphore m_render_semaphore;
+  std::vector<FrameData> m_frames;
+  // Fence of the frame currently rendering into each swapchain image
+  std::vector<VkFence> m_images_in_flight;
+
+  VkPipelineCache m_pipeline_cache;
+  bool m_pipeline_cache_warm{false};
 
   VkPipelineLayout m_triangle_pipeline_layout;
-  VkPipeline m_triangle_pipeline;
-  VkPipeline m_red_triangle_pipeline;
+  // Pipelines specialized from the same shaders, by constant values
+  std::map<SpecializationConstants, VkPipeline> m_triangle_variants;
+  VkPipelineLayout m_mesh_pipeline_layout;
+  std::map<SpecializationConstants, VkPipeline> m_mesh_variants;
+
+  DescriptorLayoutCache m_layout_cache;
+  // Sets living for the whole run
+  DescriptorAllocator m_descriptor_allocator;
+  VkDescriptorSetLayout m_instance_set_layout;
+  // Instance ids in order, for the draws that are not culled
+  AllocatedBuffer m_identity_ids;
+
+  VkDescriptorSetLayout m_cull_set_layout{VK_NULL_HANDLE};
+  VkPipelineLayout m_cull_pipeline_layout{VK_NULL_HANDLE};
+  VkPipeline m_cull_pipeline{VK_NULL_HANDLE};
+  // World to clip space transform of the mesh shaders and of the culling.
+  // Identity until set_camera() is called, the renderables are then placed in
+  // clip space
+  glm::mat4 m_view_projection{1.f};
 
-  DeletionQueue m_main_deletion_queue;
+  UniformRing m_uniforms;
+  VkDescriptorSetLayout m_frame_set_layout;
+  VkDescriptorSet m_frame_descriptor;
+  std::chrono::steady_clock::time_point m_start_time;
+
+  VkDescriptorSetLayout m_particle_compute_set_layout{VK_NULL_HANDLE};
+  VkDescriptorSetLayout m_particle_render_set_layout{VK_NULL_HANDLE};
+  VkPipelineLayout m_particle_compute_layout{VK_NULL_HANDLE};
+  VkPipeline m_particle_compute_pipeline{VK_NULL_HANDLE};
+  VkPipelineLayout m_particle_pipeline_layout{VK_NULL_HANDLE};
+  VkPipeline m_particle_pipeline{VK_NULL_HANDLE};
+  std::chrono::steady_clock::time_point m_last_simulation_time;
+
+  DeviceAllocator m_allocator;
+  UploadContext m_uploads;
+  ShaderLibrary m_shader_library;
+  std::unordered_map<std::string, Mesh> m_meshes;
+  std::unordered_map<std::string, Material> m_materials;
+  std::vector<RenderObject> m_renderables;
+  // Bumped whenever the renderables change, the batches and the instance data
+  // are only rebuilt then
+  uint64_t m_scene_version{0};
+  uint64_t m_batches_version{~0ull};
+  // Scratch storage of draw(), reused across frames
+  std::vector<RenderObject const*> m_draw_order;
+  std::vector<DrawBatch> m_draw_batches;
+  uint32_t m_draw_instance_count{0};
+  FrameStats m_frame_stats;
+  std::chrono::steady_clock::time_point m_input_time;
+  bool m_input_sampled{false};
+  double m_input_to_submit_total_ms{0.0};
+  double m_submit_to_present_total_ms{0.0};
+  uint32_t m_submit_samples{0};
+  uint32_t m_present_samples{0};
+  JobSystem m_jobs;
+  GpuProfiler m_gpu_profiler;
+
+  DeletionQueue m_deletion_queue;
 
   int m_selected_shader{0};
 
   void init_vulkan();
   void init_swapchain();
+  void init_offscreen_images();
+  void create_swapchain(VkSwapchainKHR old_swapchain);
+  void recreate_swapchain();
+  void retire_swapchain();
   void init_commands();
-  void init_default_renderpass();
-  void init_framebuffers();
+  void init_render_graph();
   void init_sync_structures();
+  void init_pipeline_cache();
+  void init_descriptors();
+  void init_particles();
   void init_pipelines();
+  void load_meshes();
+  void init_scene();
+
+  // Wait on the fence of a submitted frame and measure its latency
+  void wait_frame_fence(FrameData& frame);
+  void report_latency() const;
+  void record_frame(FrameData& frame, uint32_t image_index);
+  // Draw the scene, inside the render pass of the main pass
+  void record_main_pass(VkCommandBuffer cmd,
+                        RenderGraph::PassContext const& context);
+  void record_capture(VkCommandBuffer cmd);
+  // Record and submit the particle step of the frame to the compute queue
+  void submit_simulation(FrameData& frame);
+  void draw_particles(VkCommandBuffer cmd, FrameData const& frame);
+  // Sort the renderables by material and mesh, write their instance data and
+  // group them into instanced draws
+  void build_draw_batches(FrameData& frame);
+  // Dispatch the frustum culling of the instances, filling the indirect draws
+  void record_culling(VkCommandBuffer cmd, FrameData const& frame);
+  // Draw the instances in [first_instance, last_instance) of the batches
+  void draw_objects(VkCommandBuffer cmd, FrameData const& frame,
+                    uint32_t first_instance, uint32_t last_instance);
+  // Split the batches across the workers, each recording a secondary command
+  // buffer, and execute them from cmd
+  void record_objects_parallel(VkCommandBuffer cmd, FrameData& frame,
+                               VkFramebuffer framebuffer);
+
+  FrameData& get_current_frame();
 
  public:
-  void init();
+  void init(EngineConfig const& config = {});
   void draw();
+  // Block until at most max_queued_frames frames are in flight. run() calls
+  // it right before sampling input, so the input is as fresh as possible
+  // when the frame is recorded
+  void pace_frame();
+  // The input for the next draw() has just been sampled
+  void mark_input_sampled();
   void run();
   void cleanup();
 
-  bool load_shader_module(std::filesystem::path const& file_path,
-                          VkShaderModule* shader_module);
-};
+  void immediate_submit(std::function<void(VkCommandBuffer)>&& function);
+  // Copy the last rendered image to host memory as tightly packed RGBA8.
+  // Only available in headless mode
+  bool read_pixels(std::vector<std::uint8_t>& pixels);
+  bool save_frame(std::filesystem::path const& file_path);
 
-class PipelineBuilder
-{
-  std::vector<VkPipelineShaderStageCreateInfo> m_shader_stages;
-  VkPipelineVertexInputStateCreateInfo m_vertex_input_info;
-  VkPipelineInputAssemblyStateCreateInfo m_input_assembly;
-  VkViewport m_viewport;
-  VkRect2D m_scissor;
-  VkPipelineRasterizationStateCreateInfo m_rasterizer;
-  VkPipelineColorBlendAttachmentState m_color_blend_attachment;
-  VkPipelineMultisampleStateCreateInfo m_multisampling;
-  VkPipelineLayout m_pipeline_layout;
+  Material* create_material(VkPipeline pipeline, VkPipelineLayout layout,
+                            std::string const& name);
+  Material* get_material(std::string const& name);
+  Mesh* get_mesh(std::string const& name);
+  void add_renderable(RenderObject const& object);
+  void clear_renderables();
+  void set_camera(glm::mat4 const& view_projection);
+  // 0 and 1 draw the hardcoded triangles, 2 the renderables
+  void select_shader(int shader);
+  FrameStats const& last_frame_stats() const;
 
- public:
-  VkPipeline build_pipeline(VkDevice device, VkRenderPass pass);
-  void push_back(VkPipelineShaderStageCreateInfo&& shader_stage);
-  void set_vertex_input_info(VkPipelineVertexInputStateCreateInfo const& info);
-  void
-  set_input_assembly_info(VkPipelineInputAssemblyStateCreateInfo const& info);
-  void set_viewport(VkViewport const& viewport);
-  void set_scissor(VkRect2D const& scissor);
-  void set_rasterizer_info(VkPipelineRasterizationStateCreateInfo const& info);
-  void set_color_blend_attachment_state(
-      VkPipelineColorBlendAttachmentState const& state);
-  void set_multisampling_info(VkPipelineMultisampleStateCreateInfo const& info);
-  void set_pipeline_layout(VkPipelineLayout const& layout);
-  void clear_shaders();
+  bool load_shader_module(std::filesystem::path const& file_path,
+                          VkShaderModule* shader_module);
+  void release_shader_module(VkShaderModule shader_module);
 };
 
 #endif // ENGINE_HPP
\ No newline at end of file
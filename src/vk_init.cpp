@@ -12,6 +12,19 @@ VkCommandPoolCreateInfo command_pool_create_info(uint32_t queue_family_index,
   return info;
 }
 
+VkCommandBufferInheritanceInfo
+command_buffer_inheritance_info(VkRenderPass render_pass, uint32_t subpass,
+                                VkFramebuffer framebuffer)
+{
+  VkCommandBufferInheritanceInfo info{};
+  info.sType       = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  info.pNext       = nullptr;
+  info.renderPass  = render_pass;
+  info.subpass     = subpass;
+  info.framebuffer = framebuffer;
+  return info;
+}
+
 VkCommandBufferAllocateInfo
 command_buffer_allocate_info(VkCommandPool pool, uint32_t count,
                              VkCommandBufferLevel level)
@@ -101,15 +114,40 @@ VkPipelineColorBlendAttachmentState color_blench_attachment_state()
   return info;
 }
 
-VkPipelineLayoutCreateInfo pipeline_layout_create_info()
+VkPipelineLayoutCreateInfo pipeline_layout_create_info(
+    std::span<VkDescriptorSetLayout const> set_layouts,
+    std::span<VkPushConstantRange const> push_constant_ranges)
 {
   VkPipelineLayoutCreateInfo info{};
-  info.sType                  = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-  info.pNext                  = nullptr;
-  info.flags                  = 0;
-  info.pSetLayouts            = nullptr;
-  info.pushConstantRangeCount = 0;
-  info.pPushConstantRanges    = nullptr;
+  info.sType          = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  info.pNext          = nullptr;
+  info.flags          = 0;
+  info.setLayoutCount = static_cast<uint32_t>(set_layouts.size());
+  info.pSetLayouts    = set_layouts.data();
+  info.pushConstantRangeCount =
+      static_cast<uint32_t>(push_constant_ranges.size());
+  info.pPushConstantRanges = push_constant_ranges.data();
+  return info;
+}
+
+VkPushConstantRange push_constant_range(VkShaderStageFlags stage_flags,
+                                        uint32_t size, uint32_t offset)
+{
+  VkPushConstantRange range{};
+  range.stageFlags = stage_flags;
+  range.offset     = offset;
+  range.size       = size;
+  return range;
+}
+
+VkPipelineCacheCreateInfo pipeline_cache_create_info()
+{
+  VkPipelineCacheCreateInfo info{};
+  info.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.pNext           = nullptr;
+  info.flags           = 0;
+  info.initialDataSize = 0;
+  info.pInitialData    = nullptr;
   return info;
 }
 
@@ -131,4 +169,80 @@ VkSemaphoreCreateInfo create_semaphore_info(VkSemaphoreCreateFlags flags)
   return info;
 }
 
+VkImageCreateInfo image_create_info(VkFormat format, VkImageUsageFlags usage,
+                                    VkExtent3D extent)
+{
+  VkImageCreateInfo info{};
+  info.sType         = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  info.pNext         = nullptr;
+  info.imageType     = VK_IMAGE_TYPE_2D;
+  info.format        = format;
+  info.extent        = extent;
+  info.mipLevels     = 1;
+  info.arrayLayers   = 1;
+  info.samples       = VK_SAMPLE_COUNT_1_BIT;
+  info.tiling        = VK_IMAGE_TILING_OPTIMAL;
+  info.usage         = usage;
+  info.sharingMode   = VK_SHARING_MODE_EXCLUSIVE;
+  info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  return info;
+}
+
+VkImageViewCreateInfo imageview_create_info(VkFormat format, VkImage image,
+                                            VkImageAspectFlags aspect_flags)
+{
+  VkImageViewCreateInfo info{};
+  info.sType    = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+  info.pNext    = nullptr;
+  info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  info.image    = image;
+  info.format   = format;
+  info.subresourceRange.baseMipLevel   = 0;
+  info.subresourceRange.levelCount     = 1;
+  info.subresourceRange.baseArrayLayer = 0;
+  info.subresourceRange.layerCount     = 1;
+  info.subresourceRange.aspectMask     = aspect_flags;
+  return info;
+}
+
+VkCommandBufferBeginInfo
+command_buffer_begin_info(VkCommandBufferUsageFlags flags)
+{
+  VkCommandBufferBeginInfo info{};
+  info.sType            = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  info.pNext            = nullptr;
+  info.pInheritanceInfo = nullptr;
+  info.flags            = flags;
+  return info;
+}
+
+VkDescriptorSetLayoutBinding
+descriptorset_layout_binding(VkDescriptorType type,
+                             VkShaderStageFlags stage_flags, uint32_t binding)
+{
+  VkDescriptorSetLayoutBinding info{};
+  info.binding            = binding;
+  info.descriptorCount    = 1;
+  info.descriptorType     = type;
+  info.pImmutableSamplers = nullptr;
+  info.stageFlags         = stage_flags;
+  return info;
+}
+
+VkWriteDescriptorSet write_descriptor_buffer(VkDescriptorType type,
+                                             VkDescriptorSet dst_set,
+                                             VkDescriptorBufferInfo* buffer_info,
+                                             uint32_t binding)
+{
+  VkWriteDescriptorSet info{};
+  info.sType           = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+  info.pNext           = nullptr;
+  info.dstBinding      = binding;
+  info.dstSet          = dst_set;
+  info.descriptorCount = 1;
+  info.descriptorType  = type;
+  info.pBufferInfo     = buffer_info;
+  return info;
+}
+
 } // namespace vkinit
@@ -4,6 +4,7 @@
 #include "vk_types.hpp"
 
 #include <cinttypes>
+#include <span>
 
 namespace vkinit {
 
@@ -23,9 +24,31 @@ VkPipelineRasterizationStateCreateInfo
 rasterization_state_create_info(VkPolygonMode polygon_mode);
 VkPipelineMultisampleStateCreateInfo multisampling_state_create_info();
 VkPipelineColorBlendAttachmentState color_blench_attachment_state();
-VkPipelineLayoutCreateInfo pipeline_layout_create_info();
+// The set layouts and the ranges are referenced, not copied
+VkPipelineLayoutCreateInfo pipeline_layout_create_info(
+    std::span<VkDescriptorSetLayout const> set_layouts          = {},
+    std::span<VkPushConstantRange const> push_constant_ranges = {});
+VkPushConstantRange push_constant_range(VkShaderStageFlags stage_flags,
+                                        uint32_t size, uint32_t offset = 0);
+VkPipelineCacheCreateInfo pipeline_cache_create_info();
 VkFenceCreateInfo create_fence_info(VkFenceCreateFlagBits);
 VkSemaphoreCreateInfo create_semaphore_info(VkSemaphoreCreateFlags);
+VkImageCreateInfo image_create_info(VkFormat format, VkImageUsageFlags usage,
+                                    VkExtent3D extent);
+VkImageViewCreateInfo imageview_create_info(VkFormat format, VkImage image,
+                                            VkImageAspectFlags aspect_flags);
+VkCommandBufferBeginInfo
+command_buffer_begin_info(VkCommandBufferUsageFlags flags = 0);
+VkCommandBufferInheritanceInfo
+command_buffer_inheritance_info(VkRenderPass render_pass, uint32_t subpass,
+                                VkFramebuffer framebuffer);
+VkDescriptorSetLayoutBinding
+descriptorset_layout_binding(VkDescriptorType type,
+                             VkShaderStageFlags stage_flags, uint32_t binding);
+VkWriteDescriptorSet write_descriptor_buffer(VkDescriptorType type,
+                                             VkDescriptorSet dst_set,
+                                             VkDescriptorBufferInfo* buffer_info,
+                                             uint32_t binding);
 
 } // namespace vkinit
 
@@ -0,0 +1,67 @@
+#include "vk_jobs.hpp"
+
+#include <algorithm>
+
+void JobSystem::init(uint32_t worker_count)
+{
+  m_stopping = false;
+  worker_count = std::max(worker_count, 1u);
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    m_workers.emplace_back([this, i] { worker_loop(i); });
+  }
+}
+
+void JobSystem::destroy()
+{
+  {
+    std::lock_guard lock{m_mutex};
+    m_stopping = true;
+  }
+  m_job_available.notify_all();
+  for (auto& worker : m_workers) {
+    worker.join();
+  }
+  m_workers.clear();
+}
+
+void JobSystem::submit(Job job)
+{
+  {
+    std::lock_guard lock{m_mutex};
+    m_jobs.push(std::move(job));
+    ++m_pending;
+  }
+  m_job_available.notify_one();
+}
+
+void JobSystem::wait()
+{
+  std::unique_lock lock{m_mutex};
+  m_jobs_done.wait(lock, [this] { return m_pending == 0; });
+}
+
+uint32_t JobSystem::worker_count() const
+{
+  return static_cast<uint32_t>(m_workers.size());
+}
+
+void JobSystem::worker_loop(uint32_t worker)
+{
+  std::unique_lock lock{m_mutex};
+  while (true) {
+    m_job_available.wait(lock,
+                         [this] { return m_stopping || !m_jobs.empty(); });
+    if (m_jobs.empty()) {
+      // Only reached when stopping, after the queue has been drained
+      return;
+    }
+    auto job = std::move(m_jobs.front());
+    m_jobs.pop();
+    lock.unlock();
+    job(worker);
+    lock.lock();
+    if (--m_pending == 0) {
+      m_jobs_done.notify_all();
+    }
+  }
+}
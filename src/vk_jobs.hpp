@@ -0,0 +1,41 @@
+#ifndef VK_JOBS_HPP
+#define VK_JOBS_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed pool of worker threads running jobs from a shared queue. The
+// submitting thread blocks in wait() until every submitted job has run
+class JobSystem
+{
+ public:
+  // Receives the index of the worker running it, in [0, worker_count())
+  using Job = std::function<void(uint32_t worker)>;
+
+ private:
+  std::vector<std::thread> m_workers;
+  std::queue<Job> m_jobs;
+  std::mutex m_mutex;
+  std::condition_variable m_job_available;
+  std::condition_variable m_jobs_done;
+  uint32_t m_pending{0};
+  bool m_stopping{false};
+
+  void worker_loop(uint32_t worker);
+
+ public:
+  void init(uint32_t worker_count = std::thread::hardware_concurrency());
+  void destroy();
+
+  void submit(Job job);
+  void wait();
+
+  uint32_t worker_count() const;
+};
+
+#endif // VK_JOBS_HPP
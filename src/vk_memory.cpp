@@ -0,0 +1,299 @@
+#include "vk_memory.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+void DeviceAllocator::init(VkPhysicalDevice gpu, VkDevice device,
+                           VkDeviceSize block_size)
+{
+  m_device     = device;
+  m_block_size = block_size;
+  vkGetPhysicalDeviceMemoryProperties(gpu, &m_memory_properties);
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(gpu, &properties);
+  m_non_coherent_atom_size =
+      std::max<VkDeviceSize>(properties.limits.nonCoherentAtomSize, 1);
+}
+
+void DeviceAllocator::destroy()
+{
+  std::lock_guard lock{m_mutex};
+  for (auto& block : m_blocks) {
+    if (block.memory == VK_NULL_HANDLE) {
+      continue;
+    }
+    if (block.free_ranges.size() != 1
+        || block.free_ranges.front().size != block.size) {
+      std::cerr << "device memory block destroyed with live allocations\n";
+    }
+    vkFreeMemory(m_device, block.memory, nullptr);
+  }
+  m_blocks.clear();
+}
+
+uint32_t DeviceAllocator::find_memory_type(uint32_t type_bits,
+                                           VkMemoryPropertyFlags required,
+                                           VkMemoryPropertyFlags preferred) const
+{
+  uint32_t fallback = ~0u;
+  for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; ++i) {
+    auto flags = m_memory_properties.memoryTypes[i].propertyFlags;
+    if (!(type_bits & (1u << i)) || (flags & required) != required) {
+      continue;
+    }
+    if ((flags & preferred) == preferred) {
+      return i;
+    }
+    if (fallback == ~0u) {
+      fallback = i;
+    }
+  }
+  if (fallback == ~0u) {
+    std::cerr << "no suitable memory type found\n";
+    std::abort();
+  }
+  return fallback;
+}
+
+uint32_t DeviceAllocator::create_block(uint32_t memory_type, VkDeviceSize size,
+                                       bool linear)
+{
+  VkMemoryAllocateInfo alloc_info{};
+  alloc_info.sType           = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext           = nullptr;
+  alloc_info.allocationSize  = size;
+  alloc_info.memoryTypeIndex = memory_type;
+
+  Block block;
+  vk_check(vkAllocateMemory(m_device, &alloc_info, nullptr, &block.memory));
+  block.size        = size;
+  block.memory_type = memory_type;
+  block.linear      = linear;
+  block.free_ranges = {{0, size}};
+  if (m_memory_properties.memoryTypes[memory_type].propertyFlags
+      & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+    // Host visible blocks stay mapped for their whole lifetime
+    void* data;
+    vk_check(vkMapMemory(m_device, block.memory, 0, VK_WHOLE_SIZE, 0, &data));
+    block.mapped = static_cast<std::byte*>(data);
+  }
+
+  // Reuse the slot of a released block so that indices stay stable
+  auto it = std::find_if(m_blocks.begin(), m_blocks.end(), [](Block& b) {
+    return b.memory == VK_NULL_HANDLE;
+  });
+  if (it != m_blocks.end()) {
+    *it = std::move(block);
+    return static_cast<uint32_t>(it - m_blocks.begin());
+  }
+  m_blocks.push_back(std::move(block));
+  return static_cast<uint32_t>(m_blocks.size() - 1);
+}
+
+bool DeviceAllocator::allocate_from(Block& block,
+                                    VkMemoryRequirements const& requirements,
+                                    VkDeviceSize* offset)
+{
+  auto& ranges = block.free_ranges;
+  for (std::size_t i = 0; i < ranges.size(); ++i) {
+    auto range         = ranges[i];
+    auto aligned       = align_up(range.offset, requirements.alignment);
+    auto range_end     = range.offset + range.size;
+    auto allocated_end = aligned + requirements.size;
+    if (allocated_end > range_end) {
+      continue;
+    }
+    // Split the range, keeping the alignment padding and the tail free
+    std::vector<Range> remainder;
+    if (aligned > range.offset) {
+      remainder.push_back({range.offset, aligned - range.offset});
+    }
+    if (allocated_end < range_end) {
+      remainder.push_back({allocated_end, range_end - allocated_end});
+    }
+    ranges.erase(ranges.begin() + i);
+    ranges.insert(ranges.begin() + i, remainder.begin(), remainder.end());
+    *offset = aligned;
+    return true;
+  }
+  return false;
+}
+
+Allocation DeviceAllocator::allocate(VkMemoryRequirements const& requirements,
+                                     VkMemoryPropertyFlags required,
+                                     VkMemoryPropertyFlags preferred,
+                                     bool linear)
+{
+  std::lock_guard lock{m_mutex};
+  auto memory_type =
+      find_memory_type(requirements.memoryTypeBits, required, preferred);
+  auto aligned_requirements = requirements;
+  auto flags = m_memory_properties.memoryTypes[memory_type].propertyFlags;
+  if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+      && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+    // Keep flushed ranges from spilling over neighbouring allocations
+    aligned_requirements.alignment =
+        std::max(requirements.alignment, m_non_coherent_atom_size);
+    aligned_requirements.size =
+        align_up(requirements.size, m_non_coherent_atom_size);
+  }
+
+  Allocation allocation;
+  allocation.size = aligned_requirements.size;
+  bool found      = false;
+  for (uint32_t i = 0; i < m_blocks.size() && !found; ++i) {
+    auto& block = m_blocks[i];
+    if (block.memory == VK_NULL_HANDLE || block.memory_type != memory_type
+        || block.linear != linear) {
+      continue;
+    }
+    if (allocate_from(block, aligned_requirements, &allocation.offset)) {
+      allocation.block = i;
+      found            = true;
+    }
+  }
+  if (!found) {
+    // Oversized requests get a block of their own
+    auto size = std::max(m_block_size, aligned_requirements.size);
+    allocation.block = create_block(memory_type, size, linear);
+    allocate_from(m_blocks[allocation.block], aligned_requirements,
+                  &allocation.offset);
+  }
+
+  auto& block       = m_blocks[allocation.block];
+  allocation.memory = block.memory;
+  allocation.mapped =
+      block.mapped != nullptr ? block.mapped + allocation.offset : nullptr;
+  return allocation;
+}
+
+void DeviceAllocator::free(Allocation const& allocation)
+{
+  if (allocation.memory == VK_NULL_HANDLE) {
+    return;
+  }
+  std::lock_guard lock{m_mutex};
+  auto& block  = m_blocks[allocation.block];
+  auto& ranges = block.free_ranges;
+  auto it      = std::lower_bound(
+      ranges.begin(), ranges.end(), allocation.offset,
+      [](Range const& range, VkDeviceSize offset) {
+        return range.offset < offset;
+      });
+  it = ranges.insert(it, {allocation.offset, allocation.size});
+  // Merge with the following range, then with the preceding one
+  if (auto next = it + 1;
+      next != ranges.end() && it->offset + it->size == next->offset) {
+    it->size += next->size;
+    ranges.erase(next);
+  }
+  if (it != ranges.begin()) {
+    auto prev = it - 1;
+    if (prev->offset + prev->size == it->offset) {
+      prev->size += it->size;
+      ranges.erase(it);
+    }
+  }
+
+  // Dedicated blocks go back to the driver as soon as they are unused
+  if (block.size > m_block_size && ranges.size() == 1
+      && ranges.front().size == block.size) {
+    vkFreeMemory(m_device, block.memory, nullptr);
+    block = Block{};
+  }
+}
+
+void DeviceAllocator::flush(Allocation const& allocation, VkDeviceSize offset,
+                            VkDeviceSize size)
+{
+  std::lock_guard lock{m_mutex};
+  auto const& block = m_blocks[allocation.block];
+  auto flags =
+      m_memory_properties.memoryTypes[block.memory_type].propertyFlags;
+  if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+    return;
+  }
+  if (size == VK_WHOLE_SIZE) {
+    size = allocation.size - offset;
+  }
+  // Allocations of non coherent memory are aligned to nonCoherentAtomSize
+  VkMappedMemoryRange range{};
+  range.sType  = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.pNext  = nullptr;
+  range.memory = block.memory;
+  range.offset = allocation.offset
+               + offset / m_non_coherent_atom_size * m_non_coherent_atom_size;
+  range.size   = std::min(align_up(offset + size, m_non_coherent_atom_size),
+                          allocation.size)
+             - (range.offset - allocation.offset);
+  vk_check(vkFlushMappedMemoryRanges(m_device, 1, &range));
+}
+
+AllocatedBuffer DeviceAllocator::create_buffer(VkDeviceSize size,
+                                               VkBufferUsageFlags usage,
+                                               VkMemoryPropertyFlags required,
+                                               VkMemoryPropertyFlags preferred,
+                                               std::span<uint32_t const> queue_families)
+{
+  VkBufferCreateInfo buffer_info{};
+  buffer_info.sType       = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext       = nullptr;
+  buffer_info.size        = size;
+  buffer_info.usage       = usage;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  std::vector<uint32_t> families(queue_families.begin(), queue_families.end());
+  std::sort(families.begin(), families.end());
+  families.erase(std::unique(families.begin(), families.end()),
+                 families.end());
+  if (families.size() > 1) {
+    buffer_info.sharingMode           = VK_SHARING_MODE_CONCURRENT;
+    buffer_info.queueFamilyIndexCount = static_cast<uint32_t>(families.size());
+    buffer_info.pQueueFamilyIndices   = families.data();
+  }
+
+  AllocatedBuffer buffer;
+  buffer.size = size;
+  vk_check(vkCreateBuffer(m_device, &buffer_info, nullptr, &buffer.buffer));
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(m_device, buffer.buffer, &requirements);
+  buffer.allocation = allocate(requirements, required, preferred, true);
+  vk_check(vkBindBufferMemory(m_device, buffer.buffer, buffer.allocation.memory,
+                              buffer.allocation.offset));
+  return buffer;
+}
+
+void DeviceAllocator::destroy_buffer(AllocatedBuffer const& buffer)
+{
+  vkDestroyBuffer(m_device, buffer.buffer, nullptr);
+  free(buffer.allocation);
+}
+
+AllocatedImage DeviceAllocator::create_image(VkImageCreateInfo const& info,
+                                             VkMemoryPropertyFlags required)
+{
+  AllocatedImage image;
+  vk_check(vkCreateImage(m_device, &info, nullptr, &image.image));
+  VkMemoryRequirements requirements;
+  vkGetImageMemoryRequirements(m_device, image.image, &requirements);
+  image.allocation = allocate(requirements, required, 0,
+                              info.tiling == VK_IMAGE_TILING_LINEAR);
+  vk_check(vkBindImageMemory(m_device, image.image, image.allocation.memory,
+                             image.allocation.offset));
+  return image;
+}
+
+void DeviceAllocator::destroy_image(AllocatedImage const& image)
+{
+  vkDestroyImage(m_device, image.image, nullptr);
+  free(image.allocation);
+}
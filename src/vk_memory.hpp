@@ -0,0 +1,100 @@
+#ifndef VK_MEMORY_HPP
+#define VK_MEMORY_HPP
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <mutex>
+#include <span>
+#include <vector>
+
+// A range of device memory sub-allocated from a larger VkDeviceMemory block
+struct Allocation
+{
+  VkDeviceMemory memory{VK_NULL_HANDLE};
+  VkDeviceSize offset{0};
+  VkDeviceSize size{0};
+  // Persistent mapping of the range, nullptr if not host visible
+  std::byte* mapped{nullptr};
+  uint32_t block{0};
+};
+
+struct AllocatedBuffer
+{
+  VkBuffer buffer{VK_NULL_HANDLE};
+  Allocation allocation;
+  VkDeviceSize size{0};
+};
+
+struct AllocatedImage
+{
+  VkImage image{VK_NULL_HANDLE};
+  Allocation allocation;
+};
+
+// Sub-allocates buffers and images from a few large VkDeviceMemory blocks per
+// memory type, keeping the driver allocation count far below
+// maxMemoryAllocationCount. Each block keeps a sorted free list, allocations
+// are first fit and freed ranges are merged with their neighbours. Buffers and
+// images never share a block, so bufferImageGranularity can be ignored.
+class DeviceAllocator
+{
+  struct Range
+  {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+  };
+
+  struct Block
+  {
+    VkDeviceMemory memory{VK_NULL_HANDLE};
+    VkDeviceSize size{0};
+    std::byte* mapped{nullptr};
+    uint32_t memory_type{0};
+    bool linear{true};
+    // Sorted by offset, adjacent ranges are always merged
+    std::vector<Range> free_ranges;
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  VkPhysicalDeviceMemoryProperties m_memory_properties{};
+  VkDeviceSize m_block_size{0};
+  VkDeviceSize m_non_coherent_atom_size{1};
+  std::vector<Block> m_blocks;
+  mutable std::mutex m_mutex;
+
+  uint32_t find_memory_type(uint32_t type_bits, VkMemoryPropertyFlags required,
+                            VkMemoryPropertyFlags preferred) const;
+  uint32_t create_block(uint32_t memory_type, VkDeviceSize size, bool linear);
+  bool allocate_from(Block& block, VkMemoryRequirements const& requirements,
+                     VkDeviceSize* offset);
+
+ public:
+  void init(VkPhysicalDevice gpu, VkDevice device,
+            VkDeviceSize block_size = 64ull << 20);
+  void destroy();
+
+  // Allocate memory satisfying requirements with all the required property
+  // flags, favouring memory types that also have the preferred ones. linear
+  // is false for optimally tiled images
+  Allocation allocate(VkMemoryRequirements const& requirements,
+                      VkMemoryPropertyFlags required,
+                      VkMemoryPropertyFlags preferred = 0, bool linear = true);
+  void free(Allocation const& allocation);
+  // Flush host writes to memory that is not host coherent
+  void flush(Allocation const& allocation, VkDeviceSize offset = 0,
+             VkDeviceSize size = VK_WHOLE_SIZE);
+
+  // A buffer used by several queue families is created with concurrent
+  // sharing, so it needs no ownership transfers
+  AllocatedBuffer create_buffer(VkDeviceSize size, VkBufferUsageFlags usage,
+                                VkMemoryPropertyFlags required,
+                                VkMemoryPropertyFlags preferred = 0,
+                                std::span<uint32_t const> queue_families = {});
+  void destroy_buffer(AllocatedBuffer const& buffer);
+  AllocatedImage create_image(VkImageCreateInfo const& info,
+                              VkMemoryPropertyFlags required);
+  void destroy_image(AllocatedImage const& image);
+};
+
+#endif // VK_MEMORY_HPP
@@ -0,0 +1,107 @@
+#include "vk_mesh.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+PackedVertex Vertex::pack() const
+{
+  PackedVertex packed;
+  const uint64_t half_position = glm::packHalf4x16(glm::vec4{position, 1.f});
+  const uint32_t snorm_normal  = glm::packSnorm4x8(glm::vec4{normal, 0.f});
+  const uint32_t unorm_color   = glm::packUnorm4x8(glm::vec4{color, 1.f});
+  std::memcpy(packed.position, &half_position, sizeof(packed.position));
+  std::memcpy(packed.normal, &snorm_normal, sizeof(packed.normal));
+  std::memcpy(packed.color, &unorm_color, sizeof(packed.color));
+  return packed;
+}
+
+VertexInputDescription Vertex::get_packed_vertex_description()
+{
+  // Position, normal and color at locations 0 to 2, the vertex fetch expands
+  // the components
+  VertexInputDescription description;
+  description.bindings.push_back(
+      {0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX});
+  description.attributes.push_back({0, 0, VK_FORMAT_R16G16B16A16_SFLOAT,
+                                    offsetof(PackedVertex, position)});
+  description.attributes.push_back(
+      {1, 0, VK_FORMAT_R8G8B8A8_SNORM, offsetof(PackedVertex, normal)});
+  description.attributes.push_back(
+      {2, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(PackedVertex, color)});
+  return description;
+}
+
+void Mesh::upload(UploadContext& uploads)
+{
+  // Centered on the bounding box, not the tightest sphere but close enough
+  // for culling
+  if (!vertices.empty()) {
+    glm::vec3 min = vertices.front().position;
+    glm::vec3 max = min;
+    for (auto const& vertex : vertices) {
+      min = glm::min(min, vertex.position);
+      max = glm::max(max, vertex.position);
+    }
+    glm::vec3 center = (min + max) * 0.5f;
+    float radius     = 0.f;
+    for (auto const& vertex : vertices) {
+      radius = std::max(radius, glm::length(vertex.position - center));
+    }
+    bounds = {center, radius};
+  }
+  std::vector<PackedVertex> packed;
+  packed.reserve(vertices.size());
+  for (auto const& vertex : vertices) {
+    packed.push_back(vertex.pack());
+  }
+  vertex_buffer.count  = static_cast<uint32_t>(packed.size());
+  vertex_buffer.buffer = uploads.create_buffer(
+      packed.data(), packed.size() * sizeof(PackedVertex),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+  index_buffer.count  = static_cast<uint32_t>(indices.size());
+  index_buffer.type   = VK_INDEX_TYPE_UINT32;
+  index_buffer.buffer = uploads.create_buffer(
+      indices.data(), indices.size() * sizeof(uint32_t),
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+}
+
+void Mesh::load(MeshFile const& file, UploadContext& uploads)
+{
+  auto const& header = file.header();
+  bounds = {header.bounds[0], header.bounds[1], header.bounds[2],
+            header.bounds[3]};
+  meshlets.assign(file.meshlets().begin(), file.meshlets().end());
+  // Straight from the mapping to the staging ring
+  vertex_buffer.count  = header.vertex_count;
+  vertex_buffer.buffer = uploads.create_buffer(
+      file.vertices().data(), file.vertices().size(),
+      VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+  index_buffer.count = header.index_count;
+  index_buffer.type =
+      header.index_size == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+  index_buffer.buffer = uploads.create_buffer(
+      file.indices().data(), file.indices().size(),
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+}
+
+void Mesh::bind(VkCommandBuffer cmd) const
+{
+  VkDeviceSize offset = 0;
+  vkCmdBindVertexBuffers(cmd, 0, 1, &vertex_buffer.buffer.buffer, &offset);
+  vkCmdBindIndexBuffer(cmd, index_buffer.buffer.buffer, 0, index_buffer.type);
+}
+
+glm::mat4 Mesh::fit_transform(float radius) const
+{
+  const float scale = radius / std::max(bounds.w, 1e-6f);
+  glm::mat4 transform{1.f};
+  transform[0][0] = scale;
+  transform[1][1] = scale;
+  transform[2][2] = scale;
+  transform[3] =
+      glm::vec4{glm::vec3{0.f, 0.f, 0.5f} - glm::vec3{bounds} * scale, 1.f};
+  return transform;
+}
@@ -0,0 +1,87 @@
+#ifndef VK_MESH_HPP
+#define VK_MESH_HPP
+
+#include "vk_memory.hpp"
+#include "vk_mesh_file.hpp"
+#include "vk_pipeline.hpp"
+#include "vk_types.hpp"
+#include "vk_upload.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+#include <span>
+#include <vector>
+
+struct Vertex
+{
+  glm::vec3 position;
+  glm::vec3 normal;
+  glm::vec3 color;
+
+  // Quantized to the layout meshes are drawn with
+  PackedVertex pack() const;
+  static VertexInputDescription get_packed_vertex_description();
+};
+
+// A buffer holding count elements of T
+template<typename T>
+struct TypedBuffer
+{
+  AllocatedBuffer buffer;
+  uint32_t count{0};
+};
+
+template<typename V>
+using VertexBuffer = TypedBuffer<V>;
+
+struct IndexBuffer
+{
+  AllocatedBuffer buffer;
+  uint32_t count{0};
+  VkIndexType type{VK_INDEX_TYPE_UINT32};
+};
+
+// Create a buffer with the given usage and fill it with data. The memory is
+// host visible, preferably device local as well
+template<typename T>
+TypedBuffer<T> create_typed_buffer(DeviceAllocator& allocator,
+                                   std::span<T const> data,
+                                   VkBufferUsageFlags usage)
+{
+  TypedBuffer<T> typed;
+  typed.count  = static_cast<uint32_t>(data.size());
+  typed.buffer = allocator.create_buffer(
+      data.size_bytes(), usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  std::memcpy(typed.buffer.allocation.mapped, data.data(), data.size_bytes());
+  allocator.flush(typed.buffer.allocation);
+  return typed;
+}
+
+struct Mesh
+{
+  // Source data of upload(), left empty by load()
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  VertexBuffer<PackedVertex> vertex_buffer;
+  IndexBuffer index_buffer;
+  // Bounding sphere in model space, center in xyz and radius in w. Computed
+  // by upload(), read from the file by load()
+  glm::vec4 bounds{0.f};
+  // Only meshes loaded from a file have meshlets
+  std::vector<MeshletBounds> meshlets;
+
+  // Queue the copy of the packed vertices and the indices to device local
+  // buffers. They can be drawn from once the next uploads.submit() has
+  // completed
+  void upload(UploadContext& uploads);
+  // Same from a mesh file, whose sections are copied as they are
+  void load(MeshFile const& file, UploadContext& uploads);
+  void bind(VkCommandBuffer cmd) const;
+  // Scale and translation giving the bounding sphere this radius, centered
+  // on the origin in the middle of the depth range
+  glm::mat4 fit_transform(float radius) const;
+};
+
+#endif // VK_MESH_HPP
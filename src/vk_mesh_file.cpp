@@ -0,0 +1,278 @@
+#include "vk_mesh_file.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace {
+
+uint64_t align_up(uint64_t value, uint64_t alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+bool check_section(std::filesystem::path const& file_path, char const* name,
+                   MeshFileSection section, uint64_t expected_size,
+                   std::size_t file_size)
+{
+  if (section.size != expected_size) {
+    std::cerr << file_path << ": " << name << " section of " << section.size
+              << " bytes, expected " << expected_size << '\n';
+    return false;
+  }
+  if (section.offset % mesh_file_alignment != 0 || section.offset > file_size
+      || section.size > file_size - section.offset) {
+    std::cerr << file_path << ": " << name << " section out of the file\n";
+    return false;
+  }
+  return true;
+}
+
+int8_t quantize_snorm(float value)
+{
+  return static_cast<int8_t>(
+      std::lround(std::clamp(value, -1.f, 1.f) * 127.f));
+}
+
+MeshletBounds compute_bounds(std::span<glm::vec3 const> positions,
+                             std::span<uint32_t const> indices)
+{
+  MeshletBounds meshlet{};
+  glm::vec3 min = positions[indices.front()];
+  glm::vec3 max = min;
+  for (auto index : indices) {
+    min = glm::min(min, positions[index]);
+    max = glm::max(max, positions[index]);
+  }
+  glm::vec3 center = (min + max) * 0.5f;
+  float radius     = 0.f;
+  for (auto index : indices) {
+    radius = std::max(radius, glm::length(positions[index] - center));
+  }
+
+  // The cone axis is the average of the triangle normals, the cutoff the
+  // sine of the largest angle between the axis and a normal
+  std::vector<glm::vec3> normals;
+  glm::vec3 axis{0.f};
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    auto const& a = positions[indices[i]];
+    glm::vec3 normal =
+        glm::cross(positions[indices[i + 1]] - a, positions[indices[i + 2]] - a);
+    float area = glm::length(normal);
+    if (area > 0.f) {
+      normals.push_back(normal / area);
+      axis += normals.back();
+    }
+  }
+  float min_dot = -1.f;
+  if (glm::length(axis) > 0.f) {
+    axis    = glm::normalize(axis);
+    min_dot = 1.f;
+    for (auto const& normal : normals) {
+      min_dot = std::min(min_dot, glm::dot(axis, normal));
+    }
+  }
+  for (int i = 0; i < 3; ++i) {
+    meshlet.center[i]    = center[i];
+    meshlet.cone_axis[i] = quantize_snorm(axis[i]);
+  }
+  meshlet.radius = radius;
+  if (min_dot <= 0.f) {
+    // Normals spread over more than a hemisphere
+    meshlet.cone_cutoff = 127;
+  } else {
+    // Rounded up, so the quantized cone contains the exact one
+    float cutoff = std::sqrt(1.f - min_dot * min_dot);
+    meshlet.cone_cutoff =
+        static_cast<int8_t>(std::min(std::ceil(cutoff * 127.f) + 1.f, 127.f));
+  }
+  return meshlet;
+}
+
+} // namespace
+
+bool MeshFile::open(std::filesystem::path const& file_path)
+{
+  m_file = MappedFile{file_path};
+  if (!m_file.is_open()) {
+    std::cerr << file_path << " not found\n";
+    return false;
+  }
+  if (m_file.size() < sizeof(MeshFileHeader)) {
+    std::cerr << file_path << ": truncated mesh file (" << m_file.size()
+              << " bytes)\n";
+    return false;
+  }
+  std::memcpy(&m_header, m_file.data(), sizeof(m_header));
+  if (m_header.magic != mesh_file_magic) {
+    std::cerr << file_path << ": not a mesh file\n";
+    return false;
+  }
+  if (m_header.version != mesh_file_version) {
+    std::cerr << file_path << ": mesh file version " << m_header.version
+              << ", expected " << mesh_file_version << '\n';
+    return false;
+  }
+  if (m_header.vertex_count == 0 || m_header.index_count == 0) {
+    std::cerr << file_path << ": empty mesh\n";
+    return false;
+  }
+  if (m_header.index_size != 2 && m_header.index_size != 4) {
+    std::cerr << file_path << ": invalid index size " << m_header.index_size
+              << '\n';
+    return false;
+  }
+  if (!check_section(file_path, "vertex", m_header.vertices,
+                     uint64_t{m_header.vertex_count} * sizeof(PackedVertex),
+                     m_file.size())
+      || !check_section(file_path, "index", m_header.indices,
+                        uint64_t{m_header.index_count} * m_header.index_size,
+                        m_file.size())
+      || !check_section(
+          file_path, "meshlet", m_header.meshlets,
+          uint64_t{m_header.meshlet_count} * sizeof(MeshletBounds),
+          m_file.size())) {
+    return false;
+  }
+  // Drawing a meshlet, or an index, out of range would read past the index
+  // or the vertex buffer
+  auto const* index_data = m_file.data() + m_header.indices.offset;
+  for (uint32_t i = 0; i < m_header.index_count; ++i) {
+    uint32_t index = 0;
+    if (m_header.index_size == 2) {
+      uint16_t short_index;
+      std::memcpy(&short_index, index_data + i * 2, sizeof(short_index));
+      index = short_index;
+    } else {
+      std::memcpy(&index, index_data + i * 4, sizeof(index));
+    }
+    if (index >= m_header.vertex_count) {
+      std::cerr << file_path << ": index " << i << " is " << index << ", of "
+                << m_header.vertex_count << " vertices\n";
+      return false;
+    }
+  }
+  for (auto const& meshlet : meshlets()) {
+    if (uint64_t{meshlet.first_index} + meshlet.index_count
+        > m_header.index_count) {
+      std::cerr << file_path << ": meshlet out of the index section\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+MeshFileHeader const& MeshFile::header() const
+{
+  return m_header;
+}
+
+std::span<std::byte const> MeshFile::vertices() const
+{
+  return {m_file.data() + m_header.vertices.offset, m_header.vertices.size};
+}
+
+std::span<std::byte const> MeshFile::indices() const
+{
+  return {m_file.data() + m_header.indices.offset, m_header.indices.size};
+}
+
+std::span<MeshletBounds const> MeshFile::meshlets() const
+{
+  // The mapping is page aligned and the sections 64-byte aligned
+  return {reinterpret_cast<MeshletBounds const*>(m_file.data()
+                                                 + m_header.meshlets.offset),
+          m_header.meshlet_count};
+}
+
+bool write_mesh_file(std::filesystem::path const& file_path,
+                     MeshFileData const& data)
+{
+  MeshFileHeader header{};
+  header.magic         = mesh_file_magic;
+  header.version       = mesh_file_version;
+  header.vertex_count  = static_cast<uint32_t>(data.vertices.size());
+  header.index_count   = static_cast<uint32_t>(data.indices.size()
+                                             / data.index_size);
+  header.meshlet_count = static_cast<uint32_t>(data.meshlets.size());
+  header.index_size    = data.index_size;
+  std::memcpy(header.bounds, data.bounds, sizeof(header.bounds));
+  header.vertices.offset = align_up(sizeof(header), mesh_file_alignment);
+  header.vertices.size   = data.vertices.size_bytes();
+  header.indices.offset =
+      align_up(header.vertices.offset + header.vertices.size,
+               mesh_file_alignment);
+  header.indices.size = data.indices.size_bytes();
+  header.meshlets.offset =
+      align_up(header.indices.offset + header.indices.size,
+               mesh_file_alignment);
+  header.meshlets.size = data.meshlets.size_bytes();
+
+  std::ofstream file{file_path, std::ios::binary};
+  if (!file) {
+    std::cerr << "cannot write " << file_path << '\n';
+    return false;
+  }
+  uint64_t written = 0;
+  auto write_at    = [&](uint64_t offset, void const* bytes, uint64_t size) {
+    static constexpr char zeros[mesh_file_alignment]{};
+    file.write(zeros, static_cast<std::streamsize>(offset - written));
+    file.write(static_cast<char const*>(bytes),
+               static_cast<std::streamsize>(size));
+    written = offset + size;
+  };
+  write_at(0, &header, sizeof(header));
+  write_at(header.vertices.offset, data.vertices.data(), header.vertices.size);
+  write_at(header.indices.offset, data.indices.data(), header.indices.size);
+  write_at(header.meshlets.offset, data.meshlets.data(), header.meshlets.size);
+  if (!file) {
+    std::cerr << "cannot write " << file_path << '\n';
+    return false;
+  }
+  return true;
+}
+
+std::vector<MeshletBounds> build_meshlets(std::span<glm::vec3 const> positions,
+                                          std::span<uint32_t const> indices,
+                                          uint32_t max_vertices,
+                                          uint32_t max_triangles)
+{
+  std::vector<MeshletBounds> meshlets;
+  // Meshlet using each vertex, the unique vertex count without a set
+  std::vector<uint32_t> owner(positions.size(), ~0u);
+  uint32_t first_index  = 0;
+  uint32_t vertex_count = 0;
+  auto finish           = [&](uint32_t end) {
+    auto meshlet = compute_bounds(positions,
+                                  indices.subspan(first_index, end - first_index));
+    meshlet.first_index = first_index;
+    meshlet.index_count = end - first_index;
+    meshlets.push_back(meshlet);
+    first_index  = end;
+    vertex_count = 0;
+  };
+  for (uint32_t i = 0; i + 2 < indices.size(); i += 3) {
+    const auto id = static_cast<uint32_t>(meshlets.size());
+    uint32_t new_vertices = 0;
+    for (uint32_t j = i; j < i + 3; ++j) {
+      new_vertices += owner[indices[j]] != id ? 1 : 0;
+    }
+    if (vertex_count + new_vertices > max_vertices
+        || (i - first_index) / 3 == max_triangles) {
+      finish(i);
+    }
+    const auto current = static_cast<uint32_t>(meshlets.size());
+    for (uint32_t j = i; j < i + 3; ++j) {
+      if (owner[indices[j]] != current) {
+        owner[indices[j]] = current;
+        ++vertex_count;
+      }
+    }
+  }
+  if (first_index < indices.size()) {
+    finish(static_cast<uint32_t>(indices.size() / 3 * 3));
+  }
+  return meshlets;
+}
@@ -0,0 +1,122 @@
+#ifndef VK_MESH_FILE_HPP
+#define VK_MESH_FILE_HPP
+
+#include "vk_shader.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// Engine-native mesh container, written by the mesh_converter tool. Every
+// section is stored the way the GPU consumes it, so loading is a memory
+// mapping and a copy of each section to staging memory. Little endian.
+//
+//   MeshFileHeader
+//   PackedVertex[vertex_count]        vertex section
+//   uint16_t or uint32_t[index_count] index section
+//   MeshletBounds[meshlet_count]      meshlet section
+//
+// Sections start at offsets aligned to mesh_file_alignment.
+
+constexpr uint32_t mesh_file_magic   = 0x48534d56; // "VMSH"
+constexpr uint32_t mesh_file_version = 1;
+constexpr uint64_t mesh_file_alignment = 64;
+
+// 16 bytes, interleaved. Positions are half floats, so their precision is
+// relative to their distance to the model origin
+struct PackedVertex
+{
+  // xyz, w is 1
+  uint16_t position[4];
+  // Signed normalized xyz, w is 0
+  int8_t normal[4];
+  // Unsigned normalized rgba
+  uint8_t color[4];
+};
+static_assert(sizeof(PackedVertex) == 16);
+
+// A cluster of triangles, contiguous in the index section
+struct MeshletBounds
+{
+  // Bounding sphere in model space
+  float center[3];
+  float radius;
+  // Normal cone, signed normalized axis and cutoff. Every triangle faces
+  // away from the camera when
+  //   dot(center - camera, axis) >= cutoff * length(center - camera) + radius
+  // A cutoff of 127 never culls
+  int8_t cone_axis[3];
+  int8_t cone_cutoff;
+  uint32_t first_index;
+  uint32_t index_count;
+  uint32_t padding;
+};
+static_assert(sizeof(MeshletBounds) == 32);
+
+struct MeshFileSection
+{
+  uint64_t offset;
+  uint64_t size;
+};
+
+struct MeshFileHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t vertex_count;
+  uint32_t index_count;
+  uint32_t meshlet_count;
+  // 2 or 4 bytes
+  uint32_t index_size;
+  // Bounding sphere of the whole mesh, center in xyz and radius in w
+  float bounds[4];
+  MeshFileSection vertices;
+  MeshFileSection indices;
+  MeshFileSection meshlets;
+};
+static_assert(sizeof(MeshFileHeader) == 88);
+
+// Read-only view of a mesh file. The sections point into the mapping, valid
+// as long as the MeshFile lives
+class MeshFile
+{
+  MappedFile m_file;
+  MeshFileHeader m_header{};
+
+ public:
+  // Map and validate the file, false if it is missing or malformed
+  bool open(std::filesystem::path const& file_path);
+
+  MeshFileHeader const& header() const;
+  std::span<std::byte const> vertices() const;
+  std::span<std::byte const> indices() const;
+  std::span<MeshletBounds const> meshlets() const;
+};
+
+// Content of a mesh file to write, the sections already in their final
+// encoding
+struct MeshFileData
+{
+  std::span<PackedVertex const> vertices;
+  // uint16_t when every index fits, uint32_t otherwise
+  std::span<std::byte const> indices;
+  uint32_t index_size;
+  std::span<MeshletBounds const> meshlets;
+  float bounds[4];
+};
+
+bool write_mesh_file(std::filesystem::path const& file_path,
+                     MeshFileData const& data);
+
+// Split the triangle list into meshlets of consecutive triangles, each
+// referencing at most max_vertices vertices and max_triangles triangles
+std::vector<MeshletBounds> build_meshlets(std::span<glm::vec3 const> positions,
+                                          std::span<uint32_t const> indices,
+                                          uint32_t max_vertices  = 64,
+                                          uint32_t max_triangles = 124);
+
+#endif // VK_MESH_FILE_HPP
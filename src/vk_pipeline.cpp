@@ -0,0 +1,308 @@
+#include "vk_pipeline.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+
+#include "vk_init.hpp"
+
+namespace {
+
+// Create infos pointing into a PipelineDescription, which must outlive them
+struct PipelineCreateState
+{
+  std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
+  std::vector<VkSpecializationMapEntry> specialization_entries;
+  VkSpecializationInfo specialization_info;
+  VkPipelineVertexInputStateCreateInfo vertex_input_info;
+  VkPipelineViewportStateCreateInfo viewport_state;
+  VkPipelineDynamicStateCreateInfo dynamic_state;
+  VkPipelineColorBlendStateCreateInfo color_blending;
+  VkPipelineRenderingCreateInfoKHR rendering_info;
+  VkGraphicsPipelineCreateInfo pipeline_info;
+};
+
+void fill_create_state(PipelineDescription const& description,
+                       PipelineCreateState& state)
+{
+  state.shader_stages = description.shader_stages;
+  if (!description.specialization.empty()) {
+    auto const& constants        = description.specialization;
+    state.specialization_entries = constants.map_entries();
+    state.specialization_info    = {
+        static_cast<uint32_t>(state.specialization_entries.size()),
+        state.specialization_entries.data(), constants.size(),
+        constants.data()};
+    for (auto& stage : state.shader_stages) {
+      stage.pSpecializationInfo = &state.specialization_info;
+    }
+  }
+
+  auto const& vertex_input = description.vertex_input;
+  state.vertex_input_info  = vkinit::vertex_input_state_create_info();
+  state.vertex_input_info.vertexBindingDescriptionCount =
+      static_cast<uint32_t>(vertex_input.bindings.size());
+  state.vertex_input_info.pVertexBindingDescriptions =
+      vertex_input.bindings.data();
+  state.vertex_input_info.vertexAttributeDescriptionCount =
+      static_cast<uint32_t>(vertex_input.attributes.size());
+  state.vertex_input_info.pVertexAttributeDescriptions =
+      vertex_input.attributes.data();
+
+  auto& viewport_state = state.viewport_state;
+  viewport_state       = {};
+  viewport_state.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+  viewport_state.pNext = nullptr;
+  viewport_state.viewportCount = 1;
+  viewport_state.pViewports    = nullptr;
+  viewport_state.scissorCount  = 1;
+  viewport_state.pScissors     = nullptr;
+
+  static constexpr VkDynamicState dynamic_states[] = {
+      VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+  auto& dynamic_state = state.dynamic_state;
+  dynamic_state       = {};
+  dynamic_state.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+  dynamic_state.pNext = nullptr;
+  dynamic_state.dynamicStateCount = 2;
+  dynamic_state.pDynamicStates    = dynamic_states;
+
+  auto& color_blending = state.color_blending;
+  color_blending       = {};
+  color_blending.sType =
+      VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+  color_blending.pNext           = nullptr;
+  color_blending.logicOpEnable   = VK_FALSE;
+  color_blending.logicOp         = VK_LOGIC_OP_COPY;
+  color_blending.attachmentCount = 1;
+  color_blending.pAttachments    = &description.color_blend_attachment;
+
+  auto& pipeline_info = state.pipeline_info;
+  pipeline_info       = {};
+  pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext = nullptr;
+  pipeline_info.stageCount =
+      static_cast<uint32_t>(state.shader_stages.size());
+  pipeline_info.pStages             = state.shader_stages.data();
+  pipeline_info.pVertexInputState   = &state.vertex_input_info;
+  pipeline_info.pInputAssemblyState = &description.input_assembly;
+  pipeline_info.pViewportState      = &viewport_state;
+  pipeline_info.pRasterizationState = &description.rasterizer;
+  pipeline_info.pMultisampleState   = &description.multisampling;
+  pipeline_info.pColorBlendState    = &color_blending;
+  pipeline_info.pDynamicState       = &dynamic_state;
+  pipeline_info.layout              = description.pipeline_layout;
+  pipeline_info.renderPass          = description.render_pass;
+  pipeline_info.subpass             = 0;
+  pipeline_info.basePipelineHandle  = VK_NULL_HANDLE;
+
+  if (description.render_pass == VK_NULL_HANDLE) {
+    auto const& formats  = description.rendering_formats;
+    auto& rendering_info = state.rendering_info;
+    rendering_info       = {};
+    rendering_info.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+    rendering_info.pNext = nullptr;
+    rendering_info.colorAttachmentCount =
+        static_cast<uint32_t>(formats.color.size());
+    rendering_info.pColorAttachmentFormats = formats.color.data();
+    rendering_info.depthAttachmentFormat   = formats.depth;
+    pipeline_info.pNext                    = &rendering_info;
+  }
+}
+
+// Compile descriptions[first, last) with a single vkCreateGraphicsPipelines
+std::vector<VkPipeline>
+compile_batch(VkDevice device, VkPipelineCache cache,
+              std::vector<PipelineDescription> const& descriptions,
+              std::size_t first, std::size_t last)
+{
+  std::vector<PipelineCreateState> states(last - first);
+  std::vector<VkGraphicsPipelineCreateInfo> infos(last - first);
+  for (std::size_t i = first; i < last; ++i) {
+    fill_create_state(descriptions[i], states[i - first]);
+    infos[i - first] = states[i - first].pipeline_info;
+  }
+
+  std::vector<VkPipeline> pipelines(infos.size(), VK_NULL_HANDLE);
+  VkResult result = vkCreateGraphicsPipelines(
+      device, cache, static_cast<uint32_t>(infos.size()), infos.data(),
+      nullptr, pipelines.data());
+  if (result != VK_SUCCESS) {
+    // Pipelines that failed are left to VK_NULL_HANDLE by the driver
+    std::cerr << "failed to create pipelines with error: " << result << '\n';
+  }
+  return pipelines;
+}
+
+} // namespace
+
+bool SpecializationConstants::empty() const
+{
+  return m_ids.empty();
+}
+
+std::vector<VkSpecializationMapEntry>
+SpecializationConstants::map_entries() const
+{
+  std::vector<VkSpecializationMapEntry> entries;
+  entries.reserve(m_ids.size());
+  for (std::size_t i = 0; i < m_ids.size(); ++i) {
+    entries.push_back({m_ids[i], static_cast<uint32_t>(i * sizeof(uint32_t)),
+                       sizeof(uint32_t)});
+  }
+  return entries;
+}
+
+void const* SpecializationConstants::data() const
+{
+  return m_values.data();
+}
+
+std::size_t SpecializationConstants::size() const
+{
+  return m_values.size() * sizeof(uint32_t);
+}
+
+PipelineBuilder::Handle PipelineBuilder::enqueue(VkRenderPass pass)
+{
+  m_description.render_pass = pass;
+  m_queue.push_back(m_description);
+  return m_queue.size() - 1;
+}
+
+std::vector<std::future<VkPipeline>>
+PipelineBuilder::compile_queued(VkDevice device, VkPipelineCache cache,
+                                unsigned thread_count)
+{
+  // The workers share the queue, which is kept alive until the last one is
+  // done. Pipeline caches are internally synchronized, so no locking here
+  auto descriptions =
+      std::make_shared<std::vector<PipelineDescription>>(std::move(m_queue));
+  m_queue.clear();
+
+  const std::size_t count = descriptions->size();
+  const std::size_t workers =
+      std::clamp<std::size_t>(thread_count, 1, std::max<std::size_t>(count, 1));
+  const std::size_t batch_size = (count + workers - 1) / workers;
+
+  std::vector<std::future<VkPipeline>> futures;
+  futures.reserve(count);
+  for (std::size_t first = 0; first < count; first += batch_size) {
+    const std::size_t last = std::min(first + batch_size, count);
+    std::shared_future<std::vector<VkPipeline>> batch =
+        std::async(std::launch::async, [=] {
+          return compile_batch(device, cache, *descriptions, first, last);
+        }).share();
+    for (std::size_t i = first; i < last; ++i) {
+      futures.push_back(std::async(std::launch::deferred,
+                                   [=] { return batch.get()[i - first]; }));
+    }
+  }
+  return futures;
+}
+
+void PipelineBuilder::push_back(VkPipelineShaderStageCreateInfo&& shader_stage)
+{
+  m_description.shader_stages.push_back(std::move(shader_stage));
+}
+
+void PipelineBuilder::set_vertex_input(
+    VertexInputDescription const& description)
+{
+  m_description.vertex_input = description;
+}
+
+void PipelineBuilder::set_input_assembly_info(
+    VkPipelineInputAssemblyStateCreateInfo const& info)
+{
+  m_description.input_assembly = info;
+}
+
+void PipelineBuilder::set_rasterizer_info(
+    VkPipelineRasterizationStateCreateInfo const& info)
+{
+  m_description.rasterizer = info;
+}
+
+void PipelineBuilder::set_color_blend_attachment_state(
+    VkPipelineColorBlendAttachmentState const& state)
+{
+  m_description.color_blend_attachment = state;
+}
+
+void PipelineBuilder::set_multisampling_info(
+    VkPipelineMultisampleStateCreateInfo const& info)
+{
+  m_description.multisampling = info;
+}
+
+void PipelineBuilder::set_pipeline_layout(VkPipelineLayout const& layout)
+{
+  m_description.pipeline_layout = layout;
+}
+
+void PipelineBuilder::set_specialization(
+    SpecializationConstants const& constants)
+{
+  m_description.specialization = constants;
+}
+
+void PipelineBuilder::set_rendering_formats(RenderingFormats const& formats)
+{
+  m_description.rendering_formats = formats;
+}
+
+void PipelineBuilder::clear_shaders()
+{
+  m_description.shader_stages.clear();
+}
+
+VkPipeline ComputePipelineBuilder::build_pipeline(VkDevice device,
+                                                  VkPipelineCache cache)
+{
+  auto stage = m_shader_stage;
+  std::vector<VkSpecializationMapEntry> entries;
+  VkSpecializationInfo specialization_info{};
+  if (!m_specialization.empty()) {
+    entries             = m_specialization.map_entries();
+    specialization_info = {static_cast<uint32_t>(entries.size()),
+                           entries.data(), m_specialization.size(),
+                           m_specialization.data()};
+    stage.pSpecializationInfo = &specialization_info;
+  }
+
+  VkComputePipelineCreateInfo pipeline_info{};
+  pipeline_info.sType              = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+  pipeline_info.pNext              = nullptr;
+  pipeline_info.stage              = stage;
+  pipeline_info.layout             = m_pipeline_layout;
+  pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+
+  VkPipeline pipeline;
+  VkResult result = vkCreateComputePipelines(device, cache, 1, &pipeline_info,
+                                             nullptr, &pipeline);
+  if (result == VK_SUCCESS) {
+    return pipeline;
+  } else {
+    std::cerr << "failed to create compute pipeline with error: " << result
+              << '\n';
+    return VK_NULL_HANDLE;
+  }
+}
+
+void ComputePipelineBuilder::set_shader(
+    VkPipelineShaderStageCreateInfo const& shader_stage)
+{
+  m_shader_stage = shader_stage;
+}
+
+void ComputePipelineBuilder::set_pipeline_layout(VkPipelineLayout layout)
+{
+  m_pipeline_layout = layout;
+}
+
+void ComputePipelineBuilder::set_specialization(
+    SpecializationConstants const& constants)
+{
+  m_specialization = constants;
+}
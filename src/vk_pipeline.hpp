@@ -0,0 +1,135 @@
+#ifndef VK_PIPELINE_HPP
+#define VK_PIPELINE_HPP
+
+#include "vk_types.hpp"
+
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstring>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Vertex buffer bindings and the attributes fetched from them
+struct VertexInputDescription
+{
+  std::vector<VkVertexInputBindingDescription> bindings;
+  std::vector<VkVertexInputAttributeDescription> attributes;
+};
+
+// Values of the specialization constants of a pipeline, by constant_id. All
+// constants are 32-bit scalars (bool, int, uint or float), the set is kept
+// sorted by id so equal sets compare equal and can key pipeline variants
+class SpecializationConstants
+{
+  std::vector<uint32_t> m_ids;
+  std::vector<uint32_t> m_values;
+
+ public:
+  template<typename T>
+  SpecializationConstants& set(uint32_t constant_id, T value)
+  {
+    static_assert(std::is_arithmetic_v<T>
+                  && (std::is_same_v<T, bool> || sizeof(T) == 4));
+    uint32_t bits;
+    if constexpr (std::is_same_v<T, bool>) {
+      bits = value ? VK_TRUE : VK_FALSE;
+    } else {
+      std::memcpy(&bits, &value, sizeof(bits));
+    }
+    auto it = std::lower_bound(m_ids.begin(), m_ids.end(), constant_id);
+    auto index = it - m_ids.begin();
+    if (it != m_ids.end() && *it == constant_id) {
+      m_values[index] = bits;
+    } else {
+      m_ids.insert(it, constant_id);
+      m_values.insert(m_values.begin() + index, bits);
+    }
+    return *this;
+  }
+
+  bool empty() const;
+  std::vector<VkSpecializationMapEntry> map_entries() const;
+  void const* data() const;
+  std::size_t size() const;
+
+  auto operator<=>(SpecializationConstants const&) const = default;
+};
+
+// Attachment formats a pipeline is built against with dynamic rendering,
+// instead of a render pass. Pipelines built against the same formats can be
+// used in any pass rendering to attachments of these formats
+struct RenderingFormats
+{
+  std::vector<VkFormat> color;
+  VkFormat depth{VK_FORMAT_UNDEFINED};
+};
+
+// Fixed-function and shader state of a graphics pipeline. Viewport and
+// scissor are always dynamic, so pipelines survive swapchain resizes
+struct PipelineDescription
+{
+  std::vector<VkPipelineShaderStageCreateInfo> shader_stages;
+  VertexInputDescription vertex_input;
+  VkPipelineInputAssemblyStateCreateInfo input_assembly;
+  VkPipelineRasterizationStateCreateInfo rasterizer;
+  VkPipelineColorBlendAttachmentState color_blend_attachment;
+  VkPipelineMultisampleStateCreateInfo multisampling;
+  VkPipelineLayout pipeline_layout;
+  // VK_NULL_HANDLE with dynamic rendering, the pipeline is then built against
+  // rendering_formats
+  VkRenderPass render_pass;
+  RenderingFormats rendering_formats;
+  // Applied to every stage, stages ignore the ids they don't declare
+  SpecializationConstants specialization;
+};
+
+class PipelineBuilder
+{
+  PipelineDescription m_description{};
+  std::vector<PipelineDescription> m_queue;
+
+ public:
+  using Handle = std::size_t;
+
+  // Snapshot the current state for a later compile_queued(). The handle is
+  // the index of the matching future returned by compile_queued()
+  Handle enqueue(VkRenderPass pass);
+  // Compile every queued pipeline with one vkCreateGraphicsPipelines call per
+  // worker, spreading the queue over up to thread_count threads sharing the
+  // cache. Each future resolves to its pipeline, VK_NULL_HANDLE on failure
+  std::vector<std::future<VkPipeline>>
+  compile_queued(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE,
+                 unsigned thread_count = std::thread::hardware_concurrency());
+  void push_back(VkPipelineShaderStageCreateInfo&& shader_stage);
+  void set_vertex_input(VertexInputDescription const& description);
+  void
+  set_input_assembly_info(VkPipelineInputAssemblyStateCreateInfo const& info);
+  void set_rasterizer_info(VkPipelineRasterizationStateCreateInfo const& info);
+  void set_color_blend_attachment_state(
+      VkPipelineColorBlendAttachmentState const& state);
+  void set_multisampling_info(VkPipelineMultisampleStateCreateInfo const& info);
+  void set_pipeline_layout(VkPipelineLayout const& layout);
+  void set_specialization(SpecializationConstants const& constants);
+  // Formats used by the pipelines built or queued with no render pass
+  void set_rendering_formats(RenderingFormats const& formats);
+  void clear_shaders();
+};
+
+class ComputePipelineBuilder
+{
+  VkPipelineShaderStageCreateInfo m_shader_stage{};
+  VkPipelineLayout m_pipeline_layout{VK_NULL_HANDLE};
+  SpecializationConstants m_specialization;
+
+ public:
+  VkPipeline build_pipeline(VkDevice device,
+                            VkPipelineCache cache = VK_NULL_HANDLE);
+  void set_shader(VkPipelineShaderStageCreateInfo const& shader_stage);
+  void set_pipeline_layout(VkPipelineLayout layout);
+  void set_specialization(SpecializationConstants const& constants);
+};
+
+#endif // VK_PIPELINE_HPP
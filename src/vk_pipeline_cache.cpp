@@ -0,0 +1,142 @@
+#include "vk_pipeline_cache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace vkutil {
+
+namespace {
+
+std::vector<char> read_file(std::filesystem::path const& file_path)
+{
+  std::ifstream file{file_path, std::ios::ate | std::ios::binary};
+  if (!file.is_open()) {
+    return {};
+  }
+  std::vector<char> data(static_cast<std::size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(data.data(), data.size());
+  if (!file) {
+    return {};
+  }
+  return data;
+}
+
+// Check the header layout of VK_PIPELINE_CACHE_HEADER_VERSION_ONE. The fields
+// are read one by one since the file data has no alignment guarantee.
+bool validate_header(std::vector<char> const& data,
+                     VkPhysicalDeviceProperties const& props)
+{
+  VkPipelineCacheHeaderVersionOne header;
+  if (data.size() < sizeof(header)) {
+    std::cerr << "pipeline cache: file too small\n";
+    return false;
+  }
+  std::memcpy(&header.headerSize, data.data(), 4);
+  std::memcpy(&header.headerVersion, data.data() + 4, 4);
+  std::memcpy(&header.vendorID, data.data() + 8, 4);
+  std::memcpy(&header.deviceID, data.data() + 12, 4);
+  std::memcpy(header.pipelineCacheUUID, data.data() + 16, VK_UUID_SIZE);
+
+  if (header.headerSize < sizeof(header) || header.headerSize > data.size()) {
+    std::cerr << "pipeline cache: invalid header size\n";
+    return false;
+  }
+  if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) {
+    std::cerr << "pipeline cache: unsupported header version\n";
+    return false;
+  }
+  if (header.vendorID != props.vendorID || header.deviceID != props.deviceID) {
+    std::cerr << "pipeline cache: created by another device\n";
+    return false;
+  }
+  if (std::memcmp(header.pipelineCacheUUID, props.pipelineCacheUUID,
+                  VK_UUID_SIZE)
+      != 0) {
+    std::cerr << "pipeline cache: created by another driver version\n";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+VkPipelineCache load_pipeline_cache(VkDevice device,
+                                    VkPhysicalDeviceProperties const& props,
+                                    std::filesystem::path const& file_path,
+                                    bool* warm)
+{
+  auto data = read_file(file_path);
+  bool valid = !data.empty() && validate_header(data, props);
+
+  VkPipelineCacheCreateInfo info{};
+  info.sType           = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  info.pNext           = nullptr;
+  info.flags           = 0;
+  info.initialDataSize = valid ? data.size() : 0;
+  info.pInitialData    = valid ? data.data() : nullptr;
+
+  VkPipelineCache cache;
+  VkResult result = vkCreatePipelineCache(device, &info, nullptr, &cache);
+  if (result != VK_SUCCESS && valid) {
+    // The driver may still reject a file with a valid header, start over
+    std::cerr << "pipeline cache: rejected by the driver, discarding "
+              << file_path << '\n';
+    valid                = false;
+    info.initialDataSize = 0;
+    info.pInitialData    = nullptr;
+    result = vkCreatePipelineCache(device, &info, nullptr, &cache);
+  }
+  vk_check(result);
+  if (!valid && !data.empty()) {
+    std::error_code ec;
+    std::filesystem::remove(file_path, ec);
+  }
+  if (warm != nullptr) {
+    *warm = valid;
+  }
+  return cache;
+}
+
+bool save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+                         std::filesystem::path const& file_path)
+{
+  std::size_t size = 0;
+  if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS) {
+    return false;
+  }
+  std::vector<char> data(size);
+  if (vkGetPipelineCacheData(device, cache, &size, data.data())
+      != VK_SUCCESS) {
+    return false;
+  }
+
+  // Write next to the destination and rename, so that a crash never leaves
+  // a truncated cache behind
+  auto tmp_path = file_path;
+  tmp_path += ".tmp";
+  {
+    std::ofstream file{tmp_path, std::ios::binary | std::ios::trunc};
+    if (!file.is_open()) {
+      std::cerr << "pipeline cache: failed to open " << tmp_path << '\n';
+      return false;
+    }
+    file.write(data.data(), size);
+    if (!file) {
+      std::cerr << "pipeline cache: failed to write " << tmp_path << '\n';
+      return false;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_path, file_path, ec);
+  if (ec) {
+    std::cerr << "pipeline cache: failed to write " << file_path << ": "
+              << ec.message() << '\n';
+    return false;
+  }
+  return true;
+}
+
+} // namespace vkutil
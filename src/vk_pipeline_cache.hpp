@@ -0,0 +1,24 @@
+#ifndef VK_PIPELINE_CACHE_HPP
+#define VK_PIPELINE_CACHE_HPP
+
+#include "vk_types.hpp"
+
+#include <filesystem>
+
+namespace vkutil {
+
+// Create a pipeline cache seeded with the content of file_path. The file is
+// only used when its header matches the vendor ID, device ID and cache UUID of
+// the device, otherwise an empty cache is created. warm is set to whether the
+// file has been used.
+VkPipelineCache load_pipeline_cache(VkDevice device,
+                                    VkPhysicalDeviceProperties const& props,
+                                    std::filesystem::path const& file_path,
+                                    bool* warm = nullptr);
+// Write the cache content to file_path, replacing the file atomically
+bool save_pipeline_cache(VkDevice device, VkPipelineCache cache,
+                         std::filesystem::path const& file_path);
+
+} // namespace vkutil
+
+#endif // VK_PIPELINE_CACHE_HPP
@@ -0,0 +1,194 @@
+#include "vk_profiler.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+void GpuProfiler::init(VkPhysicalDevice gpu, VkDevice device,
+                       uint32_t queue_family, uint32_t frame_count,
+                       uint32_t max_scopes, std::size_t window)
+{
+  m_device      = device;
+  m_max_queries = max_scopes * 2;
+  m_window      = window;
+
+  uint32_t family_count = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count, nullptr);
+  std::vector<VkQueueFamilyProperties> families(family_count);
+  vkGetPhysicalDeviceQueueFamilyProperties(gpu, &family_count,
+                                           families.data());
+  const uint32_t valid_bits = families[queue_family].timestampValidBits;
+  if (valid_bits == 0) {
+    std::cerr << "GPU profiler: timestamps not supported by the queue\n";
+    return;
+  }
+  m_valid_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(gpu, &properties);
+  m_period_ns = properties.limits.timestampPeriod;
+
+  VkQueryPoolCreateInfo pool_info{};
+  pool_info.sType      = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.pNext      = nullptr;
+  pool_info.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = m_max_queries;
+  m_frames             = std::vector<FrameQueries>(frame_count);
+  for (auto& frame : m_frames) {
+    vk_check(vkCreateQueryPool(m_device, &pool_info, nullptr, &frame.pool));
+  }
+  m_results.resize(m_max_queries);
+}
+
+void GpuProfiler::destroy()
+{
+  for (auto& frame : m_frames) {
+    vkDestroyQueryPool(m_device, frame.pool, nullptr);
+  }
+  m_frames.clear();
+  m_current = nullptr;
+}
+
+bool GpuProfiler::enabled() const
+{
+  return !m_frames.empty();
+}
+
+void GpuProfiler::begin_frame(VkCommandBuffer cmd, uint32_t frame_index)
+{
+  if (!enabled()) {
+    return;
+  }
+  auto& frame = m_frames[frame_index % m_frames.size()];
+  collect(frame);
+  vkCmdResetQueryPool(cmd, frame.pool, 0, m_max_queries);
+  m_current = &frame;
+  m_open_scopes.clear();
+}
+
+void GpuProfiler::begin_scope(VkCommandBuffer cmd, char const* name)
+{
+  if (m_current == nullptr) {
+    return;
+  }
+  if (m_current->query_count + 2 > m_max_queries) {
+    // Out of queries, the scope is not measured but must still be closed
+    m_open_scopes.push_back(~0u);
+    return;
+  }
+  const uint32_t query = m_current->query_count;
+  m_current->query_count += 2;
+  m_current->scopes.push_back({name, query, query + 1});
+  m_open_scopes.push_back(
+      static_cast<uint32_t>(m_current->scopes.size() - 1));
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_current->pool,
+                      query);
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd)
+{
+  if (m_current == nullptr || m_open_scopes.empty()) {
+    return;
+  }
+  const auto index = m_open_scopes.back();
+  m_open_scopes.pop_back();
+  if (index == ~0u) {
+    return;
+  }
+  auto const& scope = m_current->scopes[index];
+  vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      m_current->pool, scope.end_query);
+}
+
+void GpuProfiler::resolve()
+{
+  for (auto& frame : m_frames) {
+    collect(frame);
+  }
+  m_current = nullptr;
+}
+
+void GpuProfiler::collect(FrameQueries& frame)
+{
+  if (frame.query_count != 0) {
+    // The frame fence has been waited on, the results are available. A scope
+    // left open has no end timestamp and makes the whole frame unavailable
+    auto result = vkGetQueryPoolResults(
+        m_device, frame.pool, 0, frame.query_count,
+        frame.query_count * sizeof(uint64_t), m_results.data(),
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (result == VK_SUCCESS) {
+      for (auto const& scope : frame.scopes) {
+        const uint64_t ticks =
+            (m_results[scope.end_query] - m_results[scope.begin_query])
+            & m_valid_mask;
+        add_sample(scope.name, ticks * m_period_ns / 1e6);
+      }
+    } else if (result != VK_NOT_READY) {
+      vk_check(result);
+    }
+  }
+  frame.scopes.clear();
+  frame.query_count = 0;
+}
+
+void GpuProfiler::add_sample(char const* name, double ms)
+{
+  auto& stats = m_stats[name];
+  if (stats.samples.size() < m_window) {
+    stats.samples.push_back(ms);
+  } else {
+    stats.samples[stats.next] = ms;
+  }
+  stats.next = (stats.next + 1) % m_window;
+  ++stats.count;
+}
+
+std::vector<GpuProfiler::Summary> GpuProfiler::summaries() const
+{
+  std::vector<Summary> summaries;
+  std::vector<double> sorted;
+  for (auto const& [name, stats] : m_stats) {
+    sorted = stats.samples;
+    std::sort(sorted.begin(), sorted.end());
+    double sum = 0.0;
+    for (auto sample : sorted) {
+      sum += sample;
+    }
+    const auto p99_index = (sorted.size() * 99) / 100;
+    summaries.push_back({name, stats.count, sorted.front(),
+                         sum / sorted.size(),
+                         sorted[std::min(p99_index, sorted.size() - 1)]});
+  }
+  std::sort(summaries.begin(), summaries.end(),
+            [](Summary const& a, Summary const& b) { return a.name < b.name; });
+  return summaries;
+}
+
+bool GpuProfiler::write_report(std::filesystem::path const& file_path) const
+{
+  std::ofstream file{file_path};
+  if (!file.is_open()) {
+    std::cerr << "failed to open " << file_path << '\n';
+    return false;
+  }
+  auto summaries = this->summaries();
+  if (file_path.extension() == ".csv") {
+    file << "scope,samples,min_ms,avg_ms,p99_ms\n";
+    for (auto const& s : summaries) {
+      file << s.name << ',' << s.count << ',' << s.min_ms << ',' << s.avg_ms
+           << ',' << s.p99_ms << '\n';
+    }
+  } else {
+    file << "{\n  \"scopes\": [";
+    for (std::size_t i = 0; i < summaries.size(); ++i) {
+      auto const& s = summaries[i];
+      file << (i == 0 ? "\n" : ",\n") << "    {\"name\": \"" << s.name
+           << "\", \"samples\": " << s.count << ", \"min_ms\": " << s.min_ms
+           << ", \"avg_ms\": " << s.avg_ms << ", \"p99_ms\": " << s.p99_ms
+           << '}';
+    }
+    file << "\n  ]\n}\n";
+  }
+  return file.good();
+}
@@ -0,0 +1,87 @@
+#ifndef VK_PROFILER_HPP
+#define VK_PROFILER_HPP
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Measures GPU time of command buffer regions with timestamp queries. Each
+// frame in flight owns a query pool; its results are read when the frame slot
+// comes around again, after its fence has been waited on, so reading never
+// stalls. Timings are kept per scope name over a rolling window.
+class GpuProfiler
+{
+  struct Scope
+  {
+    char const* name;
+    uint32_t begin_query;
+    uint32_t end_query;
+  };
+
+  struct FrameQueries
+  {
+    VkQueryPool pool{VK_NULL_HANDLE};
+    std::vector<Scope> scopes;
+    uint32_t query_count{0};
+  };
+
+  struct ScopeStats
+  {
+    // Ring of the last samples, in milliseconds
+    std::vector<double> samples;
+    std::size_t next{0};
+    std::size_t count{0};
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  double m_period_ns{1.0};
+  uint64_t m_valid_mask{~0ull};
+  uint32_t m_max_queries{0};
+  std::size_t m_window{0};
+  std::vector<FrameQueries> m_frames;
+  FrameQueries* m_current{nullptr};
+  std::vector<uint32_t> m_open_scopes;
+  std::unordered_map<std::string, ScopeStats> m_stats;
+  std::vector<uint64_t> m_results;
+
+  void collect(FrameQueries& frame);
+  void add_sample(char const* name, double ms);
+
+ public:
+  struct Summary
+  {
+    std::string name;
+    std::size_t count;
+    double min_ms;
+    double avg_ms;
+    double p99_ms;
+  };
+
+  // Does nothing and records nothing when the queue family has no timestamp
+  // support
+  void init(VkPhysicalDevice gpu, VkDevice device, uint32_t queue_family,
+            uint32_t frame_count, uint32_t max_scopes = 64,
+            std::size_t window = 1024);
+  void destroy();
+  bool enabled() const;
+
+  // Collect the results of the previous use of frame_index and reset its
+  // queries. Must be recorded outside of a render pass
+  void begin_frame(VkCommandBuffer cmd, uint32_t frame_index);
+  // name must outlive the profiler, a string literal typically
+  void begin_scope(VkCommandBuffer cmd, char const* name);
+  void end_scope(VkCommandBuffer cmd);
+  // Collect the results of every frame, once the device is idle
+  void resolve();
+
+  // Rolling statistics of every scope, sorted by name
+  std::vector<Summary> summaries() const;
+  // Write the statistics as CSV if the extension is .csv, JSON otherwise
+  bool write_report(std::filesystem::path const& file_path) const;
+};
+
+#endif // VK_PROFILER_HPP
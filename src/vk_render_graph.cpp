@@ -0,0 +1,822 @@
+#include "vk_render_graph.hpp"
+
+#include "vk_init.hpp"
+#include "vk_profiler.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <queue>
+
+namespace {
+
+constexpr VkAccessFlags write_access_mask =
+    VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+constexpr VkAccessFlags attachment_read_mask =
+    VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+    | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+
+VkImageAspectFlags aspect_flags(VkFormat format)
+{
+  switch (format) {
+  case VK_FORMAT_D16_UNORM:
+  case VK_FORMAT_X8_D24_UNORM_PACK32:
+  case VK_FORMAT_D32_SFLOAT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT;
+  case VK_FORMAT_D16_UNORM_S8_UINT:
+  case VK_FORMAT_D24_UNORM_S8_UINT:
+  case VK_FORMAT_D32_SFLOAT_S8_UINT:
+    return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  default:
+    return VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+}
+
+} // namespace
+
+void RenderGraph::init(VkDevice device, DeviceAllocator& allocator,
+                       DeletionQueue& deletion_queue, VkExtent2D extent)
+{
+  m_device         = device;
+  m_allocator      = &allocator;
+  m_deletion_queue = &deletion_queue;
+  m_extent         = extent;
+}
+
+void RenderGraph::set_dynamic_rendering(
+    PFN_vkCmdBeginRenderingKHR begin_rendering,
+    PFN_vkCmdEndRenderingKHR end_rendering)
+{
+  m_begin_rendering = begin_rendering;
+  m_end_rendering   = end_rendering;
+}
+
+void RenderGraph::destroy()
+{
+  retire(DeletionQueue::until_flush);
+  for (auto const& pass : m_passes) {
+    if (pass.render_pass != VK_NULL_HANDLE) {
+      m_deletion_queue->push(VK_OBJECT_TYPE_RENDER_PASS, pass.render_pass);
+    }
+  }
+  m_passes.clear();
+  m_resources.clear();
+  m_order.clear();
+  m_final_barriers.clear();
+}
+
+RenderGraph::Resource RenderGraph::import_image(
+    std::string name, VkFormat format, VkImageLayout initial_layout,
+    VkPipelineStageFlags initial_stages, VkImageLayout final_layout,
+    VkPipelineStageFlags final_stages, VkAccessFlags final_access)
+{
+  ResourceData resource{};
+  resource.name           = std::move(name);
+  resource.format         = format;
+  resource.imported       = true;
+  resource.initial_layout = initial_layout;
+  resource.initial_stages = initial_stages;
+  resource.final_layout   = final_layout;
+  resource.final_stages   = final_stages;
+  resource.final_access   = final_access;
+  m_resources.push_back(std::move(resource));
+  return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Resource RenderGraph::create_image(std::string name,
+                                                VkFormat format)
+{
+  ResourceData resource{};
+  resource.name     = std::move(name);
+  resource.format   = format;
+  resource.imported = false;
+  m_resources.push_back(std::move(resource));
+  return static_cast<Resource>(m_resources.size() - 1);
+}
+
+RenderGraph::Pass RenderGraph::add_pass(std::string name, Execute execute)
+{
+  PassData pass{};
+  pass.name    = std::move(name);
+  pass.execute = std::move(execute);
+  m_passes.push_back(std::move(pass));
+  return static_cast<Pass>(m_passes.size() - 1);
+}
+
+void RenderGraph::add_use(Pass pass, Use use)
+{
+  if (pass >= m_passes.size() || use.resource >= m_resources.size()) {
+    std::cerr << "render graph: unknown pass or resource\n";
+    std::abort();
+  }
+  auto& uses = m_passes[pass].uses;
+  if (std::any_of(uses.begin(), uses.end(), [&](Use const& other) {
+        return other.resource == use.resource;
+      })) {
+    std::cerr << "render graph: pass " << m_passes[pass].name << " uses "
+              << m_resources[use.resource].name << " twice\n";
+    std::abort();
+  }
+  auto& resource = m_resources[use.resource];
+  if (use.attachment) {
+    resource.usage |= aspect_flags(resource.format) & VK_IMAGE_ASPECT_DEPTH_BIT
+                        ? VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT
+                        : VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+  } else if (use.layout == VK_IMAGE_LAYOUT_GENERAL) {
+    resource.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+  } else if (use.layout == VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL) {
+    resource.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+  } else {
+    resource.usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+  }
+  uses.push_back(use);
+}
+
+void RenderGraph::write_color(Pass pass, Resource resource,
+                              std::optional<VkClearValue> clear)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                 VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                 VK_ACCESS_COLOR_ATTACHMENT_READ_BIT
+                     | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                 true, true, clear});
+}
+
+void RenderGraph::write_depth(Pass pass, Resource resource,
+                              std::optional<VkClearValue> clear)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                     | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT
+                     | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                 true, true, clear});
+}
+
+void RenderGraph::read_depth(Pass pass, Resource resource)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                 VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT
+                     | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                 VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT, false, true, {}});
+}
+
+void RenderGraph::read_texture(Pass pass, Resource resource,
+                               VkPipelineStageFlags stages)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, stages,
+                 VK_ACCESS_SHADER_READ_BIT, false, false, {}});
+}
+
+void RenderGraph::read_storage(Pass pass, Resource resource,
+                               VkPipelineStageFlags stages)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_GENERAL, stages,
+                 VK_ACCESS_SHADER_READ_BIT, false, false, {}});
+}
+
+void RenderGraph::write_storage(Pass pass, Resource resource,
+                                VkPipelineStageFlags stages)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_GENERAL, stages,
+                 VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, true,
+                 false, {}});
+}
+
+void RenderGraph::read_transfer(Pass pass, Resource resource)
+{
+  add_use(pass, {resource, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                 false, false, {}});
+}
+
+void RenderGraph::set_side_effects(Pass pass)
+{
+  m_passes.at(pass).side_effects = true;
+}
+
+void RenderGraph::compile()
+{
+  sort_passes();
+  cull_passes();
+  compute_lifetimes();
+  create_render_passes();
+  create_transients();
+  build_barriers();
+}
+
+void RenderGraph::sort_passes()
+{
+  const auto pass_count = static_cast<Pass>(m_passes.size());
+  std::vector<std::vector<Pass>> writers(m_resources.size());
+  std::vector<std::vector<Pass>> readers(m_resources.size());
+  for (Pass pass = 0; pass < pass_count; ++pass) {
+    for (auto const& use : m_passes[pass].uses) {
+      (use.write ? writers : readers)[use.resource].push_back(pass);
+    }
+  }
+
+  std::vector<std::vector<Pass>> successors(pass_count);
+  std::vector<uint32_t> predecessor_count(pass_count, 0);
+  auto add_edge = [&](Pass from, Pass to) {
+    successors[from].push_back(to);
+    ++predecessor_count[to];
+  };
+  for (std::size_t resource = 0; resource < m_resources.size(); ++resource) {
+    auto const& resource_writers = writers[resource];
+    if (resource_writers.empty()) {
+      continue;
+    }
+    for (std::size_t i = 1; i < resource_writers.size(); ++i) {
+      add_edge(resource_writers[i - 1], resource_writers[i]);
+    }
+    for (auto reader : readers[resource]) {
+      add_edge(resource_writers.back(), reader);
+    }
+  }
+
+  // Among the passes ready to run, the first declared goes first, so the
+  // order only departs from the declaration where a dependency requires it
+  std::priority_queue<Pass, std::vector<Pass>, std::greater<>> ready;
+  for (Pass pass = 0; pass < pass_count; ++pass) {
+    if (predecessor_count[pass] == 0) {
+      ready.push(pass);
+    }
+  }
+  m_order.clear();
+  while (!ready.empty()) {
+    auto pass = ready.top();
+    ready.pop();
+    m_order.push_back(pass);
+    for (auto successor : successors[pass]) {
+      if (--predecessor_count[successor] == 0) {
+        ready.push(successor);
+      }
+    }
+  }
+  if (m_order.size() != pass_count) {
+    std::cerr << "render graph: the passes have a dependency cycle\n";
+    std::abort();
+  }
+}
+
+void RenderGraph::cull_passes()
+{
+  // Walk back from the passes whose results leave the graph
+  std::vector<bool> live(m_passes.size(), false);
+  std::vector<Pass> pending;
+  for (Pass pass = 0; pass < m_passes.size(); ++pass) {
+    auto const& data = m_passes[pass];
+    bool exported = std::any_of(
+        data.uses.begin(), data.uses.end(), [&](Use const& use) {
+          return use.write && m_resources[use.resource].imported;
+        });
+    if (data.side_effects || exported) {
+      live[pass] = true;
+      pending.push_back(pass);
+    }
+  }
+  while (!pending.empty()) {
+    auto pass = pending.back();
+    pending.pop_back();
+    for (auto const& use : m_passes[pass].uses) {
+      // A clear replaces the content, every other use depends on the passes
+      // that wrote it before
+      if (use.clear) {
+        continue;
+      }
+      for (Pass writer = 0; writer < m_passes.size(); ++writer) {
+        if (live[writer] || (use.write && writer >= pass)) {
+          continue;
+        }
+        auto const& uses = m_passes[writer].uses;
+        if (std::any_of(uses.begin(), uses.end(), [&](Use const& other) {
+              return other.write && other.resource == use.resource;
+            })) {
+          live[writer] = true;
+          pending.push_back(writer);
+        }
+      }
+    }
+  }
+  for (Pass pass = 0; pass < m_passes.size(); ++pass) {
+    m_passes[pass].culled = !live[pass];
+  }
+  std::erase_if(m_order, [&](Pass pass) { return !live[pass]; });
+}
+
+void RenderGraph::compute_lifetimes()
+{
+  for (auto& resource : m_resources) {
+    resource.first_use = ~0u;
+    resource.last_use  = 0;
+  }
+  for (uint32_t i = 0; i < m_order.size(); ++i) {
+    for (auto const& use : m_passes[m_order[i]].uses) {
+      auto& resource     = m_resources[use.resource];
+      resource.first_use = std::min(resource.first_use, i);
+      resource.last_use  = std::max(resource.last_use, i);
+    }
+  }
+}
+
+void RenderGraph::create_render_passes()
+{
+  // Whether each image holds content when reaching the pass
+  std::vector<bool> written(m_resources.size());
+  for (std::size_t i = 0; i < m_resources.size(); ++i) {
+    written[i] = m_resources[i].imported
+              && m_resources[i].initial_layout != VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+  for (uint32_t i = 0; i < m_order.size(); ++i) {
+    auto& pass = m_passes[m_order[i]];
+    std::vector<VkAttachmentDescription> attachments;
+    std::vector<VkAttachmentReference> color_refs;
+    std::optional<VkAttachmentReference> depth_ref;
+    for (auto& use : pass.uses) {
+      auto const& resource = m_resources[use.resource];
+      // The content is only loaded and stored when someone can see it
+      use.load_op  = use.clear                 ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                   : written[use.resource]     ? VK_ATTACHMENT_LOAD_OP_LOAD
+                                               : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      use.store_op = resource.imported || resource.last_use > i
+                       ? VK_ATTACHMENT_STORE_OP_STORE
+                       : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      written[use.resource] = written[use.resource] || use.write;
+      if (!use.attachment) {
+        continue;
+      }
+      if (use.write && use.load_op != VK_ATTACHMENT_LOAD_OP_LOAD) {
+        use.access &= ~attachment_read_mask;
+      }
+
+      const auto aspects = aspect_flags(resource.format);
+      VkAttachmentDescription attachment{};
+      attachment.format  = resource.format;
+      attachment.samples = VK_SAMPLE_COUNT_1_BIT;
+      attachment.loadOp  = use.load_op;
+      attachment.storeOp = use.store_op;
+      attachment.stencilLoadOp = aspects & VK_IMAGE_ASPECT_STENCIL_BIT
+                                   ? use.load_op
+                                   : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+      attachment.stencilStoreOp = aspects & VK_IMAGE_ASPECT_STENCIL_BIT
+                                    ? use.store_op
+                                    : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+      // The barriers before the pass do the layout transitions
+      attachment.initialLayout = use.layout;
+      attachment.finalLayout   = use.layout;
+      VkAttachmentReference ref{static_cast<uint32_t>(attachments.size()),
+                                use.layout};
+      attachments.push_back(attachment);
+      if (!(aspects & VK_IMAGE_ASPECT_DEPTH_BIT)) {
+        color_refs.push_back(ref);
+      } else if (!depth_ref) {
+        depth_ref = ref;
+      } else {
+        std::cerr << "render graph: pass " << pass.name
+                  << " has several depth attachments\n";
+        std::abort();
+      }
+    }
+    pass.has_attachments = !attachments.empty();
+    // Dynamic rendering only needs the load and store ops
+    if (!pass.has_attachments || m_begin_rendering != nullptr) {
+      continue;
+    }
+
+    VkSubpassDescription subpass{};
+    subpass.pipelineBindPoint       = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount    = static_cast<uint32_t>(color_refs.size());
+    subpass.pColorAttachments       = color_refs.data();
+    subpass.pDepthStencilAttachment = depth_ref ? &*depth_ref : nullptr;
+
+    VkRenderPassCreateInfo render_pass_info{};
+    render_pass_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    render_pass_info.attachmentCount =
+        static_cast<uint32_t>(attachments.size());
+    render_pass_info.pAttachments = attachments.data();
+    render_pass_info.subpassCount = 1;
+    render_pass_info.pSubpasses   = &subpass;
+    vk_check(vkCreateRenderPass(m_device, &render_pass_info, nullptr,
+                                &pass.render_pass));
+  }
+}
+
+void RenderGraph::create_transients()
+{
+  std::vector<Resource> transients;
+  std::vector<VkMemoryRequirements> requirements(m_resources.size());
+  for (Resource i = 0; i < m_resources.size(); ++i) {
+    auto& resource = m_resources[i];
+    // Images of culled passes only are never created
+    if (resource.imported || resource.first_use == ~0u) {
+      continue;
+    }
+    auto image_info = vkinit::image_create_info(
+        resource.format, resource.usage, {m_extent.width, m_extent.height, 1});
+    vk_check(vkCreateImage(m_device, &image_info, nullptr, &resource.image));
+    vkGetImageMemoryRequirements(m_device, resource.image, &requirements[i]);
+    transients.push_back(i);
+  }
+
+  // Largest first, each image goes to the first slot it fits whose images
+  // are all dead by the time it is first used, or alive only after
+  std::sort(transients.begin(), transients.end(), [&](Resource a, Resource b) {
+    return requirements[a].size > requirements[b].size;
+  });
+  m_slots.clear();
+  for (auto i : transients) {
+    auto& resource       = m_resources[i];
+    auto const& required = requirements[i];
+    auto overlaps = [&](Resource other) {
+      return resource.first_use <= m_resources[other].last_use
+          && m_resources[other].first_use <= resource.last_use;
+    };
+    auto slot =
+        std::find_if(m_slots.begin(), m_slots.end(), [&](Slot& candidate) {
+          auto const& slot_requirements = candidate.requirements;
+          return (slot_requirements.memoryTypeBits & required.memoryTypeBits)
+                  != 0
+              && slot_requirements.size >= required.size
+              && std::none_of(candidate.resources.begin(),
+                              candidate.resources.end(), overlaps);
+        });
+    if (slot == m_slots.end()) {
+      Slot new_slot{};
+      new_slot.requirements = required;
+      m_slots.push_back(new_slot);
+      slot = m_slots.end() - 1;
+    }
+    slot->requirements.memoryTypeBits &= required.memoryTypeBits;
+    slot->requirements.alignment =
+        std::max(slot->requirements.alignment, required.alignment);
+    slot->resources.push_back(i);
+    resource.slot = static_cast<uint32_t>(slot - m_slots.begin());
+  }
+
+  for (auto& slot : m_slots) {
+    slot.memory = m_allocator->allocate(
+        slot.requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, false);
+    for (auto i : slot.resources) {
+      auto& resource = m_resources[i];
+      vk_check(vkBindImageMemory(m_device, resource.image, slot.memory.memory,
+                                 slot.memory.offset));
+      auto view_info = vkinit::imageview_create_info(
+          resource.format, resource.image, aspect_flags(resource.format));
+      vk_check(
+          vkCreateImageView(m_device, &view_info, nullptr, &resource.view));
+    }
+  }
+  for (auto pass : m_order) {
+    for (auto const& use : m_passes[pass].uses) {
+      auto const& resource = m_resources[use.resource];
+      if (resource.imported) {
+        continue;
+      }
+      auto& slot = m_slots[resource.slot];
+      slot.stages |= use.stages;
+      slot.write_access |= use.access & write_access_mask;
+    }
+  }
+}
+
+void RenderGraph::build_barriers()
+{
+  // Synchronization state of each image as the passes are walked through
+  struct State
+  {
+    VkImageLayout layout;
+    // Last write, and the reads since then
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    VkPipelineStageFlags read_stages;
+    // Stages the last write is already visible to
+    VkPipelineStageFlags visible_stages;
+  };
+  std::vector<State> states(m_resources.size());
+  for (std::size_t i = 0; i < m_resources.size(); ++i) {
+    auto const& resource = m_resources[i];
+    if (resource.imported) {
+      states[i] = {resource.initial_layout, resource.initial_stages, 0, 0, 0};
+    } else if (resource.slot != ~0u) {
+      // Content of a transient is never kept, but its memory may still be
+      // in use by the previous image of the slot or the previous frame
+      auto const& slot = m_slots[resource.slot];
+      states[i] = {VK_IMAGE_LAYOUT_UNDEFINED, slot.stages, slot.write_access,
+                   0, 0};
+    }
+  }
+
+  for (auto& pass : m_passes) {
+    pass.barriers.clear();
+  }
+  for (auto index : m_order) {
+    auto& pass = m_passes[index];
+    for (auto const& use : pass.uses) {
+      auto& state     = states[use.resource];
+      bool transition = state.layout != use.layout;
+      // Writes wait on every previous access, reads on the last write when
+      // it is not yet visible to their stages
+      bool needed = transition
+                 || (use.write
+                         ? (state.write_stages | state.read_stages) != 0
+                         : state.write_stages != 0
+                               && (use.stages & ~state.visible_stages) != 0);
+      if (needed) {
+        pass.barriers.push_back({use.resource, state.layout, use.layout,
+                                 state.write_stages | state.read_stages,
+                                 state.write_access, use.stages, use.access});
+      }
+      if (use.write) {
+        state = {use.layout, use.stages, use.access & write_access_mask, 0, 0};
+      } else {
+        state.layout = use.layout;
+        state.read_stages |= use.stages;
+        state.visible_stages |= use.stages;
+      }
+    }
+  }
+
+  m_final_barriers.clear();
+  for (Resource i = 0; i < m_resources.size(); ++i) {
+    auto const& resource = m_resources[i];
+    auto const& state    = states[i];
+    if (!resource.imported
+        || resource.final_layout == VK_IMAGE_LAYOUT_UNDEFINED
+        || (state.layout == resource.final_layout
+            && resource.final_access == 0)) {
+      continue;
+    }
+    m_final_barriers.push_back({i, state.layout, resource.final_layout,
+                                state.write_stages | state.read_stages,
+                                state.write_access, resource.final_stages,
+                                resource.final_access});
+  }
+}
+
+void RenderGraph::retire(uint64_t frame)
+{
+  for (auto const& [key, framebuffer] : m_framebuffers) {
+    m_deletion_queue->push(VK_OBJECT_TYPE_FRAMEBUFFER, framebuffer, frame);
+  }
+  m_framebuffers.clear();
+  for (auto& resource : m_resources) {
+    if (resource.imported || resource.image == VK_NULL_HANDLE) {
+      continue;
+    }
+    m_deletion_queue->push(VK_OBJECT_TYPE_IMAGE_VIEW, resource.view, frame);
+    m_deletion_queue->push(VK_OBJECT_TYPE_IMAGE, resource.image, frame);
+    resource.image = VK_NULL_HANDLE;
+    resource.view  = VK_NULL_HANDLE;
+    resource.slot  = ~0u;
+  }
+  for (auto const& slot : m_slots) {
+    m_deletion_queue->push(slot.memory, frame);
+  }
+  m_slots.clear();
+}
+
+void RenderGraph::resize(VkExtent2D extent, uint64_t retire_frame)
+{
+  m_extent = extent;
+  retire(retire_frame);
+  create_transients();
+  build_barriers();
+}
+
+void RenderGraph::set_image(Resource resource, VkImage image,
+                            VkImageView view)
+{
+  auto& data = m_resources.at(resource);
+  data.image = image;
+  data.view  = view;
+}
+
+void RenderGraph::set_clear_value(Pass pass, Resource resource,
+                                  VkClearValue clear)
+{
+  for (auto& use : m_passes.at(pass).uses) {
+    if (use.resource == resource && use.clear) {
+      use.clear = clear;
+      return;
+    }
+  }
+  std::cerr << "render graph: " << m_resources.at(resource).name
+            << " is not cleared by pass " << m_passes[pass].name << '\n';
+  std::abort();
+}
+
+void RenderGraph::set_subpass_contents(Pass pass, VkSubpassContents contents)
+{
+  m_passes.at(pass).contents = contents;
+}
+
+VkFramebuffer RenderGraph::get_framebuffer(Pass pass)
+{
+  auto const& data = m_passes[pass];
+  m_framebuffer_key.clear();
+  m_framebuffer_key.push_back(pass);
+  for (auto const& use : data.uses) {
+    if (use.attachment) {
+      m_framebuffer_key.push_back(handle_bits(m_resources[use.resource].view));
+    }
+  }
+  auto found = m_framebuffers.find(m_framebuffer_key);
+  if (found != m_framebuffers.end()) {
+    return found->second;
+  }
+
+  std::vector<VkImageView> views;
+  for (auto const& use : data.uses) {
+    if (use.attachment) {
+      views.push_back(m_resources[use.resource].view);
+    }
+  }
+  VkFramebufferCreateInfo fb_info{};
+  fb_info.sType           = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+  fb_info.pNext           = nullptr;
+  fb_info.renderPass      = data.render_pass;
+  fb_info.attachmentCount = static_cast<uint32_t>(views.size());
+  fb_info.pAttachments    = views.data();
+  fb_info.width           = m_extent.width;
+  fb_info.height          = m_extent.height;
+  fb_info.layers          = 1;
+  VkFramebuffer framebuffer;
+  vk_check(vkCreateFramebuffer(m_device, &fb_info, nullptr, &framebuffer));
+  m_framebuffers.emplace(m_framebuffer_key, framebuffer);
+  return framebuffer;
+}
+
+void RenderGraph::record_barriers(VkCommandBuffer cmd,
+                                  std::vector<Barrier> const& barriers)
+{
+  if (barriers.empty()) {
+    return;
+  }
+  m_image_barriers.clear();
+  VkPipelineStageFlags src_stages = 0;
+  VkPipelineStageFlags dst_stages = 0;
+  for (auto const& barrier : barriers) {
+    auto const& resource = m_resources[barrier.resource];
+    VkImageMemoryBarrier image_barrier{};
+    image_barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_barrier.pNext               = nullptr;
+    image_barrier.srcAccessMask       = barrier.src_access;
+    image_barrier.dstAccessMask       = barrier.dst_access;
+    image_barrier.oldLayout           = barrier.old_layout;
+    image_barrier.newLayout           = barrier.new_layout;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.image               = resource.image;
+    image_barrier.subresourceRange = {aspect_flags(resource.format), 0, 1, 0,
+                                      1};
+    m_image_barriers.push_back(image_barrier);
+    src_stages |= barrier.src_stages;
+    dst_stages |= barrier.dst_stages;
+  }
+  // An image nothing touched before only needs its layout transition
+  if (src_stages == 0) {
+    src_stages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  }
+  vkCmdPipelineBarrier(
+      cmd, src_stages, dst_stages, 0, 0, nullptr, 0, nullptr,
+      static_cast<uint32_t>(m_image_barriers.size()), m_image_barriers.data());
+}
+
+void RenderGraph::begin_rendering(VkCommandBuffer cmd, PassData const& pass)
+{
+  m_color_attachments.clear();
+  VkRenderingAttachmentInfoKHR depth_attachment{};
+  bool has_depth   = false;
+  bool has_stencil = false;
+  for (auto const& use : pass.uses) {
+    if (!use.attachment) {
+      continue;
+    }
+    auto const& resource = m_resources[use.resource];
+    VkRenderingAttachmentInfoKHR attachment{};
+    attachment.sType       = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    attachment.pNext       = nullptr;
+    attachment.imageView   = resource.view;
+    attachment.imageLayout = use.layout;
+    attachment.resolveMode = VK_RESOLVE_MODE_NONE;
+    attachment.loadOp      = use.load_op;
+    attachment.storeOp     = use.store_op;
+    attachment.clearValue  = use.clear.value_or(VkClearValue{});
+    const auto aspects     = aspect_flags(resource.format);
+    if (aspects & VK_IMAGE_ASPECT_DEPTH_BIT) {
+      depth_attachment = attachment;
+      has_depth        = true;
+      has_stencil      = (aspects & VK_IMAGE_ASPECT_STENCIL_BIT) != 0;
+    } else {
+      m_color_attachments.push_back(attachment);
+    }
+  }
+
+  VkRenderingInfoKHR rendering_info{};
+  rendering_info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+  rendering_info.pNext = nullptr;
+  rendering_info.flags =
+      pass.contents == VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+          ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR
+          : 0;
+  rendering_info.renderArea = {{0, 0}, m_extent};
+  rendering_info.layerCount = 1;
+  rendering_info.colorAttachmentCount =
+      static_cast<uint32_t>(m_color_attachments.size());
+  rendering_info.pColorAttachments  = m_color_attachments.data();
+  rendering_info.pDepthAttachment   = has_depth ? &depth_attachment : nullptr;
+  rendering_info.pStencilAttachment = has_stencil ? &depth_attachment
+                                                  : nullptr;
+  m_begin_rendering(cmd, &rendering_info);
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd, GpuProfiler* profiler)
+{
+  for (auto const& resource : m_resources) {
+    if (resource.imported && resource.image == VK_NULL_HANDLE
+        && resource.first_use != ~0u) {
+      std::cerr << "render graph: " << resource.name << " was not set\n";
+      std::abort();
+    }
+  }
+  for (auto index : m_order) {
+    auto const& pass = m_passes[index];
+    record_barriers(cmd, pass.barriers);
+    if (profiler != nullptr) {
+      profiler->begin_scope(cmd, pass.name.c_str());
+    }
+    PassContext context{pass.render_pass, VK_NULL_HANDLE, m_extent};
+    if (pass.has_attachments && m_begin_rendering != nullptr) {
+      begin_rendering(cmd, pass);
+      pass.execute(cmd, context);
+      m_end_rendering(cmd);
+    } else if (pass.has_attachments) {
+      context.framebuffer = get_framebuffer(index);
+      m_clear_values.clear();
+      for (auto const& use : pass.uses) {
+        if (use.attachment) {
+          m_clear_values.push_back(use.clear.value_or(VkClearValue{}));
+        }
+      }
+      VkRenderPassBeginInfo rp_info{};
+      rp_info.sType             = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+      rp_info.pNext             = nullptr;
+      rp_info.renderPass        = pass.render_pass;
+      rp_info.renderArea.offset = {0, 0};
+      rp_info.renderArea.extent = m_extent;
+      rp_info.framebuffer       = context.framebuffer;
+      rp_info.clearValueCount = static_cast<uint32_t>(m_clear_values.size());
+      rp_info.pClearValues    = m_clear_values.data();
+      vkCmdBeginRenderPass(cmd, &rp_info, pass.contents);
+      pass.execute(cmd, context);
+      vkCmdEndRenderPass(cmd);
+    } else {
+      pass.execute(cmd, context);
+    }
+    if (profiler != nullptr) {
+      profiler->end_scope(cmd);
+    }
+  }
+  record_barriers(cmd, m_final_barriers);
+}
+
+VkRenderPass RenderGraph::render_pass(Pass pass) const
+{
+  return m_passes.at(pass).render_pass;
+}
+
+VkImage RenderGraph::image(Resource resource) const
+{
+  return m_resources.at(resource).image;
+}
+
+VkImageView RenderGraph::image_view(Resource resource) const
+{
+  return m_resources.at(resource).view;
+}
+
+RenderingFormats RenderGraph::rendering_formats(Pass pass) const
+{
+  RenderingFormats formats;
+  for (auto const& use : m_passes.at(pass).uses) {
+    if (!use.attachment) {
+      continue;
+    }
+    auto format = m_resources[use.resource].format;
+    if (aspect_flags(format) & VK_IMAGE_ASPECT_DEPTH_BIT) {
+      formats.depth = format;
+    } else {
+      formats.color.push_back(format);
+    }
+  }
+  return formats;
+}
+
+bool RenderGraph::is_culled(Pass pass) const
+{
+  return m_passes.at(pass).culled;
+}
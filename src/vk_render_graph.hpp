@@ -0,0 +1,222 @@
+#ifndef VK_RENDER_GRAPH_HPP
+#define VK_RENDER_GRAPH_HPP
+
+#include "vk_deletion_queue.hpp"
+#include "vk_memory.hpp"
+#include "vk_pipeline.hpp"
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+class GpuProfiler;
+
+// A frame described as passes declaring the images they read and write.
+// The passes writing an image run in declaration order, and the passes
+// reading it after all of them, so a consumer may be declared before its
+// producers. compile():
+// - orders the passes along these dependencies
+// - culls the passes whose results never reach an imported image
+// - derives the barriers and layout transitions between the passes
+// - creates a render pass per pass with attachments, unless the passes are
+//   recorded with dynamic rendering
+// - places the transient images whose lifetimes do not overlap in the same
+//   memory
+// execute() then records the passes, each preceded by its barriers.
+class RenderGraph
+{
+ public:
+  using Resource = uint32_t;
+  using Pass     = uint32_t;
+
+  struct PassContext
+  {
+    // VK_NULL_HANDLE for passes without attachments, and with dynamic
+    // rendering
+    VkRenderPass render_pass;
+    VkFramebuffer framebuffer;
+    VkExtent2D extent;
+  };
+  // Records the pass, inside its render pass if it has attachments
+  using Execute = std::function<void(VkCommandBuffer, PassContext const&)>;
+
+ private:
+  struct Use
+  {
+    Resource resource;
+    VkImageLayout layout;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    bool write;
+    bool attachment;
+    std::optional<VkClearValue> clear;
+    VkAttachmentLoadOp load_op{VK_ATTACHMENT_LOAD_OP_LOAD};
+    VkAttachmentStoreOp store_op{VK_ATTACHMENT_STORE_OP_STORE};
+  };
+
+  struct Barrier
+  {
+    Resource resource;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkPipelineStageFlags src_stages;
+    VkAccessFlags src_access;
+    VkPipelineStageFlags dst_stages;
+    VkAccessFlags dst_access;
+  };
+
+  struct PassData
+  {
+    std::string name;
+    Execute execute;
+    std::vector<Use> uses;
+    bool side_effects{false};
+    bool culled{false};
+    bool has_attachments{false};
+    VkSubpassContents contents{VK_SUBPASS_CONTENTS_INLINE};
+    VkRenderPass render_pass{VK_NULL_HANDLE};
+    // Recorded right before the pass
+    std::vector<Barrier> barriers;
+  };
+
+  struct ResourceData
+  {
+    std::string name;
+    VkFormat format;
+    bool imported;
+    // Imported images: state on entry, and the state to leave them in
+    VkImageLayout initial_layout{VK_IMAGE_LAYOUT_UNDEFINED};
+    VkPipelineStageFlags initial_stages{VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT};
+    VkImageLayout final_layout{VK_IMAGE_LAYOUT_UNDEFINED};
+    VkPipelineStageFlags final_stages{VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT};
+    VkAccessFlags final_access{0};
+    VkImage image{VK_NULL_HANDLE};
+    VkImageView view{VK_NULL_HANDLE};
+    // Transient images: usage gathered from the passes, and first and last
+    // use in execution order
+    VkImageUsageFlags usage{0};
+    uint32_t first_use{~0u};
+    uint32_t last_use{0};
+    // Memory slot of a live transient
+    uint32_t slot{~0u};
+  };
+
+  // Memory shared by transients with disjoint lifetimes
+  struct Slot
+  {
+    VkMemoryRequirements requirements;
+    std::vector<Resource> resources;
+    Allocation memory;
+    // Every access to the slot in a frame. The first use of each of its
+    // images waits on them, as the previous image in the slot, or the
+    // previous frame, may still be using the memory
+    VkPipelineStageFlags stages{0};
+    VkAccessFlags write_access{0};
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  DeviceAllocator* m_allocator{nullptr};
+  DeletionQueue* m_deletion_queue{nullptr};
+  VkExtent2D m_extent{};
+  // Set with dynamic rendering, render pass objects are used otherwise
+  PFN_vkCmdBeginRenderingKHR m_begin_rendering{nullptr};
+  PFN_vkCmdEndRenderingKHR m_end_rendering{nullptr};
+  std::vector<PassData> m_passes;
+  std::vector<ResourceData> m_resources;
+  // Passes to record, in execution order
+  std::vector<Pass> m_order;
+  // Transitions of the imported images to their final layout
+  std::vector<Barrier> m_final_barriers;
+  std::vector<Slot> m_slots;
+  // By pass and attachment views, swapchain images each get their own
+  std::map<std::vector<uint64_t>, VkFramebuffer> m_framebuffers;
+  // Scratch storage of execute(), reused across frames
+  std::vector<VkImageMemoryBarrier> m_image_barriers;
+  std::vector<VkClearValue> m_clear_values;
+  std::vector<uint64_t> m_framebuffer_key;
+  std::vector<VkRenderingAttachmentInfoKHR> m_color_attachments;
+
+  void add_use(Pass pass, Use use);
+  void sort_passes();
+  void cull_passes();
+  void compute_lifetimes();
+  void create_render_passes();
+  void create_transients();
+  void build_barriers();
+  void retire(uint64_t frame);
+  VkFramebuffer get_framebuffer(Pass pass);
+  void record_barriers(VkCommandBuffer cmd,
+                       std::vector<Barrier> const& barriers);
+  void begin_rendering(VkCommandBuffer cmd, PassData const& pass);
+
+ public:
+  void init(VkDevice device, DeviceAllocator& allocator,
+            DeletionQueue& deletion_queue, VkExtent2D extent);
+  // Hand every object to the deletion queue
+  void destroy();
+  // Record the passes with VK_KHR_dynamic_rendering instead of render pass
+  // and framebuffer objects. Must be called before compile()
+  void set_dynamic_rendering(PFN_vkCmdBeginRenderingKHR begin_rendering,
+                             PFN_vkCmdEndRenderingKHR end_rendering);
+
+  // An image owned outside the graph, set with set_image() before every
+  // execute(). It is entered in initial_layout, after initial_stages, and
+  // left in final_layout, visible to final_stages. Passes writing imported
+  // images are never culled
+  Resource import_image(std::string name, VkFormat format,
+                        VkImageLayout initial_layout,
+                        VkPipelineStageFlags initial_stages,
+                        VkImageLayout final_layout,
+                        VkPipelineStageFlags final_stages
+                        = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        VkAccessFlags final_access = 0);
+  // An image owned by the graph, the size of the extent. Its content does
+  // not survive the frame
+  Resource create_image(std::string name, VkFormat format);
+  Pass add_pass(std::string name, Execute execute);
+  // Without a clear value, the previous content is loaded
+  void write_color(Pass pass, Resource resource,
+                   std::optional<VkClearValue> clear = {});
+  void write_depth(Pass pass, Resource resource,
+                   std::optional<VkClearValue> clear = {});
+  void read_depth(Pass pass, Resource resource);
+  void read_texture(Pass pass, Resource resource,
+                    VkPipelineStageFlags stages
+                    = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  void read_storage(Pass pass, Resource resource,
+                    VkPipelineStageFlags stages
+                    = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  void write_storage(Pass pass, Resource resource,
+                     VkPipelineStageFlags stages
+                     = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  // Copy from the image with transfer commands
+  void read_transfer(Pass pass, Resource resource);
+  // Keep the pass even if nothing reads its results
+  void set_side_effects(Pass pass);
+
+  void compile();
+  // Recreate the transient images and the framebuffers. The old ones are
+  // destroyed once the frames before retire_frame have completed
+  void resize(VkExtent2D extent, uint64_t retire_frame);
+
+  void set_image(Resource resource, VkImage image, VkImageView view);
+  void set_clear_value(Pass pass, Resource resource, VkClearValue clear);
+  void set_subpass_contents(Pass pass, VkSubpassContents contents);
+  // Record the passes, with a profiler scope per pass when given one
+  void execute(VkCommandBuffer cmd, GpuProfiler* profiler = nullptr);
+
+  // VK_NULL_HANDLE with dynamic rendering
+  VkRenderPass render_pass(Pass pass) const;
+  // Formats of the attachments of a pass, to build its pipelines against
+  RenderingFormats rendering_formats(Pass pass) const;
+  VkImage image(Resource resource) const;
+  VkImageView image_view(Resource resource) const;
+  bool is_culled(Pass pass) const;
+};
+
+#endif // VK_RENDER_GRAPH_HPP
@@ -0,0 +1,236 @@
+#include "vk_shader.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+constexpr uint32_t spirv_magic = 0x07230203;
+// Magic, version, generator, bound and schema words
+constexpr std::size_t spirv_header_size = 5 * sizeof(uint32_t);
+
+// FNV-1a
+uint64_t hash_bytes(std::byte const* data, std::size_t size)
+{
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (std::size_t i = 0; i < size; ++i) {
+    hash ^= static_cast<uint64_t>(data[i]);
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+bool validate_spirv(std::filesystem::path const& file_path,
+                    MappedFile const& file)
+{
+  if (file.size() < spirv_header_size || file.size() % sizeof(uint32_t) != 0) {
+    std::cerr << file_path << ": truncated SPIR-V (" << file.size()
+              << " bytes)\n";
+    return false;
+  }
+  if (reinterpret_cast<std::uintptr_t>(file.data()) % alignof(uint32_t) != 0) {
+    std::cerr << file_path << ": SPIR-V code is not 4-byte aligned\n";
+    return false;
+  }
+  uint32_t magic;
+  std::memcpy(&magic, file.data(), sizeof(magic));
+  if (magic != spirv_magic) {
+    std::cerr << file_path << ": not a SPIR-V binary\n";
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+MappedFile::MappedFile(std::filesystem::path const& file_path)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileW(file_path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    return;
+  }
+  m_file = file;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+    close();
+    return;
+  }
+  m_mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (m_mapping == nullptr) {
+    close();
+    return;
+  }
+  m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+  if (m_data == nullptr) {
+    close();
+    return;
+  }
+  m_size = static_cast<std::size_t>(size.QuadPart);
+#else
+  int fd = ::open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat info;
+  if (::fstat(fd, &info) == 0 && info.st_size > 0) {
+    void* data = ::mmap(nullptr, static_cast<std::size_t>(info.st_size),
+                        PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      m_data = data;
+      m_size = static_cast<std::size_t>(info.st_size);
+    }
+  }
+  // The mapping stays valid once the descriptor is closed
+  ::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+  *this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+  if (this != &other) {
+    close();
+    m_data = std::exchange(other.m_data, nullptr);
+    m_size = std::exchange(other.m_size, 0);
+#ifdef _WIN32
+    m_file    = std::exchange(other.m_file, nullptr);
+    m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+  }
+  return *this;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+  if (m_data != nullptr) {
+    UnmapViewOfFile(m_data);
+  }
+  if (m_mapping != nullptr) {
+    CloseHandle(m_mapping);
+  }
+  if (m_file != nullptr) {
+    CloseHandle(m_file);
+  }
+  m_file    = nullptr;
+  m_mapping = nullptr;
+#else
+  if (m_data != nullptr) {
+    ::munmap(m_data, m_size);
+  }
+#endif
+  m_data = nullptr;
+  m_size = 0;
+}
+
+bool MappedFile::is_open() const
+{
+  return m_data != nullptr;
+}
+
+std::byte const* MappedFile::data() const
+{
+  return static_cast<std::byte const*>(m_data);
+}
+
+std::size_t MappedFile::size() const
+{
+  return m_size;
+}
+
+void ShaderLibrary::init(VkDevice device)
+{
+  m_device = device;
+}
+
+void ShaderLibrary::destroy()
+{
+  std::lock_guard lock{m_mutex};
+  for (auto& [hash, entry] : m_entries) {
+    vkDestroyShaderModule(m_device, entry.module, nullptr);
+  }
+  m_entries.clear();
+  m_hashes.clear();
+}
+
+VkShaderModule ShaderLibrary::acquire(std::filesystem::path const& file_path)
+{
+  MappedFile file{file_path};
+  if (!file.is_open()) {
+    std::cerr << file_path << " not found\n";
+    return VK_NULL_HANDLE;
+  }
+  if (!validate_spirv(file_path, file)) {
+    return VK_NULL_HANDLE;
+  }
+  const uint64_t hash = hash_bytes(file.data(), file.size());
+
+  std::lock_guard lock{m_mutex};
+  auto it = m_entries.find(hash);
+  if (it != m_entries.end() && it->second.file.size() == file.size()
+      && std::memcmp(it->second.file.data(), file.data(), file.size()) == 0) {
+    ++it->second.references;
+    return it->second.module;
+  }
+
+  // The driver copies the code, the mapping is only kept for comparisons
+  VkShaderModuleCreateInfo create_info{};
+  create_info.sType    = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+  create_info.pNext    = nullptr;
+  create_info.codeSize = file.size();
+  create_info.pCode    = reinterpret_cast<uint32_t const*>(file.data());
+
+  VkShaderModule module;
+  if (vkCreateShaderModule(m_device, &create_info, nullptr, &module)
+      != VK_SUCCESS) {
+    return VK_NULL_HANDLE;
+  }
+  if (it != m_entries.end()) {
+    // Same hash, different code: keep the module out of the cache
+    std::cerr << file_path << ": shader hash collision, not deduplicated\n";
+    return module;
+  }
+  m_entries.emplace(hash, Entry{module, std::move(file), 1});
+  m_hashes.emplace(module, hash);
+  return module;
+}
+
+void ShaderLibrary::release(VkShaderModule module)
+{
+  std::lock_guard lock{m_mutex};
+  auto hash = m_hashes.find(module);
+  if (hash == m_hashes.end()) {
+    // Not cached, owned by the caller alone
+    vkDestroyShaderModule(m_device, module, nullptr);
+    return;
+  }
+  auto entry = m_entries.find(hash->second);
+  if (--entry->second.references == 0) {
+    vkDestroyShaderModule(m_device, module, nullptr);
+    m_entries.erase(entry);
+    m_hashes.erase(hash);
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef VK_SHADER_HPP
+#define VK_SHADER_HPP
+
+#include "vk_types.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <unordered_map>
+
+// Read-only memory mapping of a whole file
+class MappedFile
+{
+  void* m_data{nullptr};
+  std::size_t m_size{0};
+#ifdef _WIN32
+  void* m_file{nullptr};
+  void* m_mapping{nullptr};
+#endif
+
+  void close();
+
+ public:
+  MappedFile() = default;
+  explicit MappedFile(std::filesystem::path const& file_path);
+  ~MappedFile();
+
+  MappedFile(MappedFile&& other) noexcept;
+  MappedFile& operator=(MappedFile&& other) noexcept;
+  MappedFile(MappedFile const&)            = delete;
+  MappedFile& operator=(MappedFile const&) = delete;
+
+  bool is_open() const;
+  std::byte const* data() const;
+  std::size_t size() const;
+};
+
+// Creates shader modules straight from memory mapped SPIR-V files. Modules are
+// deduplicated by content hash and reference counted: identical binaries share
+// one VkShaderModule, destroyed when its last user releases it.
+class ShaderLibrary
+{
+  struct Entry
+  {
+    VkShaderModule module;
+    // Compared on a hash hit, the hash alone may collide. A mapping rather
+    // than a copy, the pages are only read back on a hit
+    MappedFile file;
+    uint32_t references;
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  std::unordered_map<uint64_t, Entry> m_entries;
+  std::unordered_map<VkShaderModule, uint64_t> m_hashes;
+  std::mutex m_mutex;
+
+ public:
+  void init(VkDevice device);
+  // Destroy every module, whether released or not
+  void destroy();
+
+  // VK_NULL_HANDLE if the file is missing or is not valid SPIR-V
+  VkShaderModule acquire(std::filesystem::path const& file_path);
+  void release(VkShaderModule module);
+};
+
+#endif // VK_SHADER_HPP
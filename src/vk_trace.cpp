@@ -0,0 +1,127 @@
+#include "vk_trace.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace vktrace {
+
+namespace {
+
+struct Event
+{
+  char const* name;
+  uint64_t begin_ns;
+  uint64_t end_ns;
+};
+
+// Single producer ring: only the owning thread writes, the writer of the trace
+// reads the published events. Once full, the oldest events are overwritten
+struct ThreadBuffer
+{
+  static constexpr std::size_t capacity = 1 << 16;
+
+  uint32_t thread_id;
+  std::atomic<uint64_t> head{0};
+  std::array<Event, capacity> events;
+};
+
+struct Registry
+{
+  std::mutex mutex;
+  // Never shrinks, buffers outlive their threads so late dumps still see them
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+Registry& registry()
+{
+  static Registry instance;
+  return instance;
+}
+
+ThreadBuffer& thread_buffer()
+{
+  // Registration is the only locked operation, once per thread
+  thread_local ThreadBuffer* buffer = [] {
+    auto& reg = registry();
+    std::lock_guard lock{reg.mutex};
+    reg.buffers.push_back(std::make_unique<ThreadBuffer>());
+    reg.buffers.back()->thread_id = static_cast<uint32_t>(reg.buffers.size());
+    return reg.buffers.back().get();
+  }();
+  return *buffer;
+}
+
+} // namespace
+
+uint64_t now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void record(char const* name, uint64_t begin_ns, uint64_t end_ns)
+{
+  auto& buffer = thread_buffer();
+  const auto head = buffer.head.load(std::memory_order_relaxed);
+  buffer.events[head % ThreadBuffer::capacity] = {name, begin_ns, end_ns};
+  buffer.head.store(head + 1, std::memory_order_release);
+}
+
+bool write_chrome_trace(std::filesystem::path const& file_path)
+{
+  if (!enabled) {
+    std::cerr << "tracing compiled out, build with VKENGINE_ENABLE_TRACING\n";
+    return false;
+  }
+  std::ofstream file{file_path};
+  if (!file.is_open()) {
+    std::cerr << "failed to open " << file_path << '\n';
+    return false;
+  }
+  // Meant to be called once the traced threads are idle: events written
+  // concurrently with the dump may be torn
+  auto& reg = registry();
+  std::lock_guard lock{reg.mutex};
+  uint64_t origin_ns = ~0ull;
+  for (auto const& buffer : reg.buffers) {
+    const auto head  = buffer->head.load(std::memory_order_acquire);
+    const auto first = head > ThreadBuffer::capacity
+                         ? head - ThreadBuffer::capacity
+                         : 0;
+    if (first != head) {
+      origin_ns = std::min(origin_ns,
+                           buffer->events[first % ThreadBuffer::capacity]
+                               .begin_ns);
+    }
+  }
+
+  file << "{\"traceEvents\":[";
+  bool first_event = true;
+  for (auto const& buffer : reg.buffers) {
+    const auto head  = buffer->head.load(std::memory_order_acquire);
+    const auto first = head > ThreadBuffer::capacity
+                         ? head - ThreadBuffer::capacity
+                         : 0;
+    for (auto i = first; i < head; ++i) {
+      auto const& event = buffer->events[i % ThreadBuffer::capacity];
+      // Complete events, timestamps in microseconds
+      file << (first_event ? "\n" : ",\n") << "{\"name\":\"" << event.name
+           << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->thread_id
+           << ",\"ts\":" << (event.begin_ns - origin_ns) / 1000.0
+           << ",\"dur\":" << (event.end_ns - event.begin_ns) / 1000.0 << '}';
+      first_event = false;
+    }
+  }
+  file << "\n]}\n";
+  return file.good();
+}
+
+} // namespace vktrace
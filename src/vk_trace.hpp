@@ -0,0 +1,49 @@
+#ifndef VK_TRACE_HPP
+#define VK_TRACE_HPP
+
+#include <cstdint>
+#include <filesystem>
+
+// Scoped CPU tracing. TRACE_SCOPE("name") records the time spent until the
+// end of the enclosing block into a ring buffer owned by the calling thread;
+// write_chrome_trace() dumps every thread's events in the Chrome trace event
+// format (chrome://tracing, Perfetto). Without VKENGINE_ENABLE_TRACING the
+// macro expands to nothing.
+namespace vktrace {
+
+#ifdef VKENGINE_ENABLE_TRACING
+inline constexpr bool enabled = true;
+#else
+inline constexpr bool enabled = false;
+#endif
+
+uint64_t now_ns();
+// name must be a string literal or otherwise outlive the trace
+void record(char const* name, uint64_t begin_ns, uint64_t end_ns);
+bool write_chrome_trace(std::filesystem::path const& file_path);
+
+class Scope
+{
+  char const* m_name;
+  uint64_t m_begin_ns;
+
+ public:
+  explicit Scope(char const* name) : m_name{name}, m_begin_ns{now_ns()} {}
+  ~Scope() { record(m_name, m_begin_ns, now_ns()); }
+
+  Scope(Scope const&)            = delete;
+  Scope& operator=(Scope const&) = delete;
+};
+
+} // namespace vktrace
+
+#ifdef VKENGINE_ENABLE_TRACING
+#define VKTRACE_CONCAT_IMPL(a, b) a##b
+#define VKTRACE_CONCAT(a, b) VKTRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) \
+  ::vktrace::Scope VKTRACE_CONCAT(trace_scope_, __LINE__) { name }
+#else
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+#endif // VK_TRACE_HPP
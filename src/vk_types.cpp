@@ -1 +1,12 @@
 #include "vk_types.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+void vk_check(VkResult err)
+{
+  if (err) {
+    std::cout << "Vulkan error: " << err << '\n';
+    std::abort();
+  }
+}
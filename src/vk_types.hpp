@@ -3,4 +3,22 @@
 
 #include <vulkan/vulkan.hpp>
 
+#include <cstdint>
+#include <type_traits>
+
+// Abort on any Vulkan error
+void vk_check(VkResult err);
+
+// Non-dispatchable handles are pointers on 64-bit platforms, integers
+// otherwise
+template<typename T>
+uint64_t handle_bits(T handle)
+{
+  if constexpr (std::is_pointer_v<T>) {
+    return reinterpret_cast<std::uintptr_t>(handle);
+  } else {
+    return static_cast<uint64_t>(handle);
+  }
+}
+
 #endif // VK_TYPES_HPP
\ No newline at end of file
@@ -0,0 +1,64 @@
+#include "vk_uniform.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+} // namespace
+
+void UniformRing::init(DeviceAllocator& allocator, VkPhysicalDevice gpu,
+                       uint32_t frame_count, VkDeviceSize partition_size)
+{
+  VkPhysicalDeviceProperties properties;
+  vkGetPhysicalDeviceProperties(gpu, &properties);
+  m_allocator = &allocator;
+  m_alignment =
+      std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment,
+                             1);
+  m_partition_size = align_up(partition_size, m_alignment);
+  m_buffer         = allocator.create_buffer(
+      m_partition_size * frame_count, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  m_partition_offset = 0;
+  m_head             = 0;
+}
+
+void UniformRing::begin_frame(uint32_t frame_index)
+{
+  m_partition_offset = m_partition_size * frame_index;
+  m_head             = 0;
+}
+
+uint32_t UniformRing::push(void const* data, VkDeviceSize size)
+{
+  auto offset = align_up(m_head, m_alignment);
+  if (offset + size > m_partition_size) {
+    std::cerr << "uniform ring: " << m_partition_size
+              << " bytes per frame exhausted\n";
+    std::abort();
+  }
+  std::memcpy(m_buffer.allocation.mapped + m_partition_offset + offset, data,
+              size);
+  m_head = offset + size;
+  return static_cast<uint32_t>(m_partition_offset + offset);
+}
+
+void UniformRing::flush()
+{
+  if (m_head != 0) {
+    m_allocator->flush(m_buffer.allocation, m_partition_offset, m_head);
+  }
+}
+
+AllocatedBuffer const& UniformRing::buffer() const
+{
+  return m_buffer;
+}
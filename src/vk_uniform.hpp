@@ -0,0 +1,43 @@
+#ifndef VK_UNIFORM_HPP
+#define VK_UNIFORM_HPP
+
+#include "vk_memory.hpp"
+#include "vk_types.hpp"
+
+#include <cstdint>
+
+// A persistently mapped uniform buffer split into one partition per frame in
+// flight. Uniforms are appended to the partition of the current frame and
+// bound with a dynamic offset, so per-draw data costs a memcpy rather than a
+// buffer or a descriptor update. A partition is only rewritten once the frame
+// that last used it has completed.
+class UniformRing
+{
+  DeviceAllocator* m_allocator{nullptr};
+  AllocatedBuffer m_buffer;
+  VkDeviceSize m_alignment{1};
+  VkDeviceSize m_partition_size{0};
+  VkDeviceSize m_partition_offset{0};
+  VkDeviceSize m_head{0};
+
+ public:
+  void init(DeviceAllocator& allocator, VkPhysicalDevice gpu,
+            uint32_t frame_count, VkDeviceSize partition_size = 64 << 10);
+
+  // Start appending to the partition of frame_index
+  void begin_frame(uint32_t frame_index);
+  // Copy size bytes into the current partition and return the dynamic
+  // offset to bind them with
+  uint32_t push(void const* data, VkDeviceSize size);
+  template<typename T>
+  uint32_t push(T const& data)
+  {
+    return push(&data, sizeof(T));
+  }
+  // Make the writes of the current frame visible to the device
+  void flush();
+
+  AllocatedBuffer const& buffer() const;
+};
+
+#endif // VK_UNIFORM_HPP
@@ -0,0 +1,283 @@
+#include "vk_upload.hpp"
+
+#include "vk_init.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment)
+{
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+// Enough for the texel size of every color format
+constexpr VkDeviceSize image_copy_alignment = 16;
+
+} // namespace
+
+void UploadContext::init(VkDevice device, DeviceAllocator& allocator,
+                         VkQueue queue, uint32_t queue_family,
+                         uint32_t consumer_family, VkDeviceSize staging_size)
+{
+  m_device         = device;
+  m_allocator      = &allocator;
+  m_queue          = queue;
+  m_queue_families = {queue_family};
+  if (consumer_family != queue_family) {
+    m_queue_families.push_back(consumer_family);
+  }
+
+  auto pool_info = vkinit::command_pool_create_info(
+      queue_family, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT
+                        | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+  vk_check(vkCreateCommandPool(m_device, &pool_info, nullptr, &m_command_pool));
+
+  VkSemaphoreTypeCreateInfoKHR type_info{};
+  type_info.sType         = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+  type_info.pNext         = nullptr;
+  type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+  type_info.initialValue  = 0;
+  auto semaphore_info     = vkinit::create_semaphore_info(0);
+  semaphore_info.pNext    = &type_info;
+  vk_check(vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_semaphore));
+  m_wait_semaphores = reinterpret_cast<PFN_vkWaitSemaphoresKHR>(
+      vkGetDeviceProcAddr(m_device, "vkWaitSemaphoresKHR"));
+  m_get_semaphore_counter_value =
+      reinterpret_cast<PFN_vkGetSemaphoreCounterValueKHR>(
+          vkGetDeviceProcAddr(m_device, "vkGetSemaphoreCounterValueKHR"));
+
+  m_staging = allocator.create_buffer(
+      staging_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+  m_head          = 0;
+  m_used          = 0;
+  m_staging_bytes = 0;
+  m_next_value    = 1;
+}
+
+void UploadContext::destroy()
+{
+  submit();
+  wait(submitted_value());
+  m_in_flight.clear();
+  m_allocator->destroy_buffer(m_staging);
+  vkDestroySemaphore(m_device, m_semaphore, nullptr);
+  vkDestroyCommandPool(m_device, m_command_pool, nullptr);
+  m_free_command_buffers.clear();
+}
+
+void UploadContext::retire_completed()
+{
+  auto completed = completed_value();
+  while (!m_in_flight.empty() && m_in_flight.front().value <= completed) {
+    auto const& batch = m_in_flight.front();
+    m_used -= batch.staging_bytes;
+    m_free_command_buffers.push_back(batch.cmd);
+    m_in_flight.pop_front();
+  }
+  if (m_used == 0) {
+    m_head = 0;
+  }
+}
+
+VkDeviceSize UploadContext::allocate(VkDeviceSize size,
+                                     VkDeviceSize alignment)
+{
+  const auto capacity = m_staging.size;
+  if (size > capacity) {
+    std::cerr << "upload context: " << size
+              << " bytes do not fit the staging ring of " << capacity
+              << " bytes\n";
+    std::abort();
+  }
+  retire_completed();
+  while (true) {
+    // Space is released in allocation order, so the free space always
+    // starts at the head, wrapping around the end of the ring. Wrapping
+    // gives up the bytes left at the end
+    auto offset = align_up(m_head, alignment);
+    VkDeviceSize needed;
+    if (offset + size <= capacity) {
+      needed = offset + size - m_head;
+    } else {
+      offset = 0;
+      needed = capacity - m_head + size;
+    }
+    if (m_used + needed <= capacity) {
+      m_used += needed;
+      m_staging_bytes += needed;
+      m_head = offset + size;
+      return offset;
+    }
+    // Full of copies in flight, this batch included
+    if (m_in_flight.empty()) {
+      submit();
+    }
+    wait(m_in_flight.front().value);
+    retire_completed();
+  }
+}
+
+VkCommandBuffer UploadContext::command_buffer()
+{
+  if (m_cmd != VK_NULL_HANDLE) {
+    return m_cmd;
+  }
+  if (m_free_command_buffers.empty()) {
+    auto alloc_info = vkinit::command_buffer_allocate_info(m_command_pool, 1);
+    VkCommandBuffer cmd;
+    vk_check(vkAllocateCommandBuffers(m_device, &alloc_info, &cmd));
+    m_free_command_buffers.push_back(cmd);
+  }
+  m_cmd = m_free_command_buffers.back();
+  m_free_command_buffers.pop_back();
+  auto begin_info = vkinit::command_buffer_begin_info(
+      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  vk_check(vkBeginCommandBuffer(m_cmd, &begin_info));
+  return m_cmd;
+}
+
+void UploadContext::upload_buffer(AllocatedBuffer const& buffer,
+                                  void const* data, VkDeviceSize size,
+                                  VkDeviceSize offset)
+{
+  auto const* bytes = static_cast<std::byte const*>(data);
+  // Half the ring at most, so a large copy streams through it while the
+  // first chunks are in flight
+  const auto chunk_size = std::max<VkDeviceSize>(m_staging.size / 2, 1);
+  for (VkDeviceSize done = 0; done < size; done += chunk_size) {
+    auto chunk          = std::min(chunk_size, size - done);
+    auto staging_offset = allocate(chunk, 4);
+    std::memcpy(m_staging.allocation.mapped + staging_offset, bytes + done,
+                chunk);
+    m_allocator->flush(m_staging.allocation, staging_offset, chunk);
+    VkBufferCopy region{staging_offset, offset + done, chunk};
+    vkCmdCopyBuffer(command_buffer(), m_staging.buffer, buffer.buffer, 1,
+                    &region);
+  }
+}
+
+void UploadContext::upload_image(VkImage image, VkExtent3D extent,
+                                 void const* data, VkDeviceSize size,
+                                 VkImageLayout final_layout)
+{
+  auto staging_offset = allocate(size, image_copy_alignment);
+  std::memcpy(m_staging.allocation.mapped + staging_offset, data, size);
+  m_allocator->flush(m_staging.allocation, staging_offset, size);
+  auto cmd = command_buffer();
+
+  VkImageMemoryBarrier barrier{};
+  barrier.sType               = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.pNext               = nullptr;
+  barrier.srcAccessMask       = 0;
+  barrier.dstAccessMask       = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout           = VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout           = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image               = image;
+  barrier.subresourceRange    = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  // The whole level is copied, which any image transfer granularity allows
+  VkBufferImageCopy region{};
+  region.bufferOffset      = staging_offset;
+  region.bufferRowLength   = 0;
+  region.bufferImageHeight = 0;
+  region.imageSubresource  = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageOffset       = {0, 0, 0};
+  region.imageExtent       = extent;
+  vkCmdCopyBufferToImage(cmd, m_staging.buffer, image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+  // The semaphore makes the copy visible to the consumers, the barrier only
+  // orders the layout transition after it
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout     = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barrier.newLayout     = final_layout;
+  vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+}
+
+AllocatedBuffer UploadContext::create_buffer(void const* data,
+                                             VkDeviceSize size,
+                                             VkBufferUsageFlags usage)
+{
+  auto buffer = m_allocator->create_buffer(
+      size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0, m_queue_families);
+  upload_buffer(buffer, data, size);
+  return buffer;
+}
+
+uint64_t UploadContext::submit()
+{
+  if (m_cmd == VK_NULL_HANDLE) {
+    return submitted_value();
+  }
+  vk_check(vkEndCommandBuffer(m_cmd));
+
+  const uint64_t value = m_next_value;
+  VkTimelineSemaphoreSubmitInfoKHR timeline_info{};
+  timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+  timeline_info.pNext = nullptr;
+  timeline_info.signalSemaphoreValueCount = 1;
+  timeline_info.pSignalSemaphoreValues    = &value;
+
+  VkSubmitInfo submit_info{};
+  submit_info.sType                = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.pNext                = &timeline_info;
+  submit_info.commandBufferCount   = 1;
+  submit_info.pCommandBuffers      = &m_cmd;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores    = &m_semaphore;
+  vk_check(vkQueueSubmit(m_queue, 1, &submit_info, VK_NULL_HANDLE));
+
+  m_in_flight.push_back({value, m_cmd, m_staging_bytes});
+  m_cmd           = VK_NULL_HANDLE;
+  m_staging_bytes = 0;
+  ++m_next_value;
+  return value;
+}
+
+uint64_t UploadContext::submitted_value() const
+{
+  return m_next_value - 1;
+}
+
+uint64_t UploadContext::completed_value() const
+{
+  uint64_t value;
+  vk_check(m_get_semaphore_counter_value(m_device, m_semaphore, &value));
+  return value;
+}
+
+void UploadContext::wait(uint64_t value) const
+{
+  VkSemaphoreWaitInfoKHR wait_info{};
+  wait_info.sType          = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+  wait_info.pNext          = nullptr;
+  wait_info.semaphoreCount = 1;
+  wait_info.pSemaphores    = &m_semaphore;
+  wait_info.pValues        = &value;
+  vk_check(m_wait_semaphores(m_device, &wait_info, UINT64_MAX));
+}
+
+VkSemaphore UploadContext::semaphore() const
+{
+  return m_semaphore;
+}
+
+std::span<uint32_t const> UploadContext::queue_families() const
+{
+  return m_queue_families;
+}
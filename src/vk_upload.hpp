@@ -0,0 +1,92 @@
+#ifndef VK_UPLOAD_HPP
+#define VK_UPLOAD_HPP
+
+#include "vk_memory.hpp"
+#include "vk_types.hpp"
+
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <vector>
+
+// Copies data to device local buffers and images from a persistently mapped
+// staging ring. Copies are recorded into a batch until submit(), which sends
+// the whole batch to the transfer queue with a single vkQueueSubmit and
+// signals the next value of a timeline semaphore. The consumers wait on that
+// value on the device, so uploading never blocks the CPU unless the ring is
+// full of copies still in flight. Not thread safe.
+class UploadContext
+{
+  struct Batch
+  {
+    uint64_t value;
+    VkCommandBuffer cmd;
+    // Staging bytes released once the batch has completed
+    VkDeviceSize staging_bytes;
+  };
+
+  VkDevice m_device{VK_NULL_HANDLE};
+  DeviceAllocator* m_allocator{nullptr};
+  VkQueue m_queue{VK_NULL_HANDLE};
+  // Transfer family first, then the consumer family if different
+  std::vector<uint32_t> m_queue_families;
+  VkCommandPool m_command_pool{VK_NULL_HANDLE};
+  std::vector<VkCommandBuffer> m_free_command_buffers;
+  VkSemaphore m_semaphore{VK_NULL_HANDLE};
+  PFN_vkWaitSemaphoresKHR m_wait_semaphores{nullptr};
+  PFN_vkGetSemaphoreCounterValueKHR m_get_semaphore_counter_value{nullptr};
+
+  AllocatedBuffer m_staging;
+  VkDeviceSize m_head{0};
+  VkDeviceSize m_used{0};
+
+  // Batch being recorded, signaling m_next_value
+  VkCommandBuffer m_cmd{VK_NULL_HANDLE};
+  VkDeviceSize m_staging_bytes{0};
+  uint64_t m_next_value{1};
+  // Submitted batches, oldest first
+  std::deque<Batch> m_in_flight;
+
+  // Reserve size bytes of the ring, waiting for batches in flight if needed,
+  // and return their offset
+  VkDeviceSize allocate(VkDeviceSize size, VkDeviceSize alignment);
+  VkCommandBuffer command_buffer();
+  void retire_completed();
+
+ public:
+  // consumer_family is the queue family using the uploaded resources
+  void init(VkDevice device, DeviceAllocator& allocator, VkQueue queue,
+            uint32_t queue_family, uint32_t consumer_family,
+            VkDeviceSize staging_size = 32ull << 20);
+  // Wait for the copies in flight and destroy everything
+  void destroy();
+
+  // Queue a copy of data to buffer at offset. Copies larger than the ring
+  // are split
+  void upload_buffer(AllocatedBuffer const& buffer, void const* data,
+                     VkDeviceSize size, VkDeviceSize offset = 0);
+  // Queue a copy of tightly packed texels to the first mip level of a color
+  // image, left in final_layout. The image must be shared with the consumer
+  // family, see queue_families()
+  void upload_image(VkImage image, VkExtent3D extent, void const* data,
+                    VkDeviceSize size, VkImageLayout final_layout);
+  // A device local buffer filled with data, usable once the value returned
+  // by the next submit() is reached
+  AllocatedBuffer create_buffer(void const* data, VkDeviceSize size,
+                                VkBufferUsageFlags usage);
+
+  // Submit the copies queued since the last submit. Returns the value the
+  // semaphore reaches once they are done, the last submitted one if nothing
+  // was queued
+  uint64_t submit();
+  // Last submitted value, consumers wait on it
+  uint64_t submitted_value() const;
+  uint64_t completed_value() const;
+  // Block until value is reached
+  void wait(uint64_t value) const;
+  VkSemaphore semaphore() const;
+  // Families resources written by the uploads must be shared between
+  std::span<uint32_t const> queue_families() const;
+};
+
+#endif // VK_UPLOAD_HPP
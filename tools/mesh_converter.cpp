@@ -0,0 +1,225 @@
+// Converts a Wavefront OBJ file to the engine mesh format, see
+// src/vk_mesh_file.hpp. Faces are triangulated as fans, the vertices sharing
+// a position and a normal are merged, and missing normals are computed from
+// the faces. Per-vertex colors are read from the "v x y z r g b" extension.
+
+#include "vk_engine/vk_engine.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct ObjData
+{
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> colors;
+  std::vector<glm::vec3> normals;
+  // Position and normal index of each face corner, triangulated. The normal
+  // index is ~0u when the face has none
+  std::vector<std::pair<uint32_t, uint32_t>> corners;
+};
+
+std::string_view next_token(std::string_view& line)
+{
+  auto begin = line.find_first_not_of(" \t\r");
+  if (begin == std::string_view::npos) {
+    line = {};
+    return {};
+  }
+  line       = line.substr(begin);
+  auto end   = std::min(line.find_first_of(" \t\r"), line.size());
+  auto token = line.substr(0, end);
+  line       = line.substr(end);
+  return token;
+}
+
+float parse_float(std::string_view token)
+{
+  // std::from_chars for floats is missing from some standard libraries
+  return std::strtof(std::string{token}.c_str(), nullptr);
+}
+
+// 1-based, or negative relative to the end. ~0u when absent or invalid
+uint32_t parse_index(std::string_view token, std::size_t count)
+{
+  long value = 0;
+  auto result =
+      std::from_chars(token.data(), token.data() + token.size(), value);
+  if (result.ec != std::errc{} || value == 0) {
+    return ~0u;
+  }
+  long index = value > 0 ? value - 1 : static_cast<long>(count) + value;
+  return index >= 0 && static_cast<std::size_t>(index) < count
+             ? static_cast<uint32_t>(index)
+             : ~0u;
+}
+
+bool parse_obj(std::filesystem::path const& file_path, ObjData& obj)
+{
+  std::ifstream file{file_path};
+  if (!file) {
+    std::cerr << file_path << " not found\n";
+    return false;
+  }
+  std::string line_storage;
+  std::vector<std::pair<uint32_t, uint32_t>> face;
+  for (uint32_t line_number = 1; std::getline(file, line_storage);
+       ++line_number) {
+    std::string_view line{line_storage};
+    auto keyword = next_token(line);
+    if (keyword == "v") {
+      glm::vec3 position, color{1.f};
+      for (int i = 0; i < 3; ++i) {
+        position[i] = parse_float(next_token(line));
+      }
+      auto red = next_token(line);
+      if (!red.empty()) {
+        color = {parse_float(red), parse_float(next_token(line)),
+                 parse_float(next_token(line))};
+      }
+      obj.positions.push_back(position);
+      obj.colors.push_back(color);
+    } else if (keyword == "vn") {
+      glm::vec3 normal;
+      for (int i = 0; i < 3; ++i) {
+        normal[i] = parse_float(next_token(line));
+      }
+      obj.normals.push_back(normal);
+    } else if (keyword == "f") {
+      face.clear();
+      for (auto corner = next_token(line); !corner.empty();
+           corner      = next_token(line)) {
+        // position/texcoord/normal, texcoord and normal optional
+        auto slash    = corner.find('/');
+        auto position = parse_index(corner.substr(0, slash),
+                                    obj.positions.size());
+        uint32_t normal = ~0u;
+        if (slash != std::string_view::npos) {
+          auto second = corner.find('/', slash + 1);
+          if (second != std::string_view::npos) {
+            normal = parse_index(corner.substr(second + 1), obj.normals.size());
+          }
+        }
+        if (position == ~0u) {
+          std::cerr << file_path << ':' << line_number
+                    << ": invalid face vertex " << corner << '\n';
+          return false;
+        }
+        face.emplace_back(position, normal);
+      }
+      for (std::size_t i = 2; i < face.size(); ++i) {
+        obj.corners.push_back(face[0]);
+        obj.corners.push_back(face[i - 1]);
+        obj.corners.push_back(face[i]);
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  if (argc != 3) {
+    std::cerr << "usage: " << argv[0] << " input.obj output.vmesh\n";
+    return 1;
+  }
+  ObjData obj;
+  if (!parse_obj(argv[1], obj)) {
+    return 1;
+  }
+  if (obj.corners.empty()) {
+    std::cerr << argv[1] << ": no faces\n";
+    return 1;
+  }
+
+  // Corners without a normal share the area weighted normal of the faces
+  // around their position
+  std::vector<glm::vec3> face_normals(obj.positions.size(), glm::vec3{0.f});
+  for (std::size_t i = 0; i < obj.corners.size(); i += 3) {
+    auto const& a = obj.positions[obj.corners[i].first];
+    auto const& b = obj.positions[obj.corners[i + 1].first];
+    auto const& c = obj.positions[obj.corners[i + 2].first];
+    glm::vec3 normal = glm::cross(b - a, c - a);
+    for (std::size_t j = i; j < i + 3; ++j) {
+      face_normals[obj.corners[j].first] += normal;
+    }
+  }
+
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  indices.reserve(obj.corners.size());
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> unique;
+  for (auto const& corner : obj.corners) {
+    auto [it, inserted] =
+        unique.emplace(corner, static_cast<uint32_t>(vertices.size()));
+    if (inserted) {
+      glm::vec3 normal = corner.second != ~0u ? obj.normals[corner.second]
+                                              : face_normals[corner.first];
+      if (glm::length(normal) > 0.f) {
+        normal = glm::normalize(normal);
+      }
+      vertices.push_back(
+          {obj.positions[corner.first], normal, obj.colors[corner.first]});
+    }
+    indices.push_back(it->second);
+  }
+
+  std::vector<glm::vec3> positions;
+  std::vector<PackedVertex> packed;
+  positions.reserve(vertices.size());
+  packed.reserve(vertices.size());
+  for (auto const& vertex : vertices) {
+    positions.push_back(vertex.position);
+    packed.push_back(vertex.pack());
+  }
+  auto meshlets = build_meshlets(positions, indices);
+
+  // Same bounding sphere as Mesh::upload()
+  glm::vec3 min = positions.front();
+  glm::vec3 max = min;
+  for (auto const& position : positions) {
+    min = glm::min(min, position);
+    max = glm::max(max, position);
+  }
+  glm::vec3 center = (min + max) * 0.5f;
+  float radius     = 0.f;
+  for (auto const& position : positions) {
+    radius = std::max(radius, glm::length(position - center));
+  }
+
+  // 16-bit indices whenever they fit, halving the index fetch
+  std::vector<uint16_t> short_indices;
+  MeshFileData data{};
+  data.vertices  = packed;
+  data.meshlets  = meshlets;
+  data.bounds[0] = center.x;
+  data.bounds[1] = center.y;
+  data.bounds[2] = center.z;
+  data.bounds[3] = radius;
+  if (vertices.size() <= 0x10000) {
+    short_indices.assign(indices.begin(), indices.end());
+    data.indices    = std::as_bytes(std::span{short_indices});
+    data.index_size = sizeof(uint16_t);
+  } else {
+    data.indices    = std::as_bytes(std::span{indices});
+    data.index_size = sizeof(uint32_t);
+  }
+  if (!write_mesh_file(argv[2], data)) {
+    return 1;
+  }
+  std::cerr << argv[2] << ": " << vertices.size() << " vertices, "
+            << indices.size() / 3 << " triangles, " << meshlets.size()
+            << " meshlets\n";
+  return 0;
+}
@@ -0,0 +1,450 @@
+// Reorders the triangles and vertices of a mesh file, see
+// src/vk_mesh_file.hpp, to draw it with less vertex shading and fetching:
+// - triangles are ordered for the post-transform vertex cache with Tipsify
+//   (Sander, Nehab and Barczak 2007)
+// - clusters of these triangles are then sorted to draw the outward facing
+//   ones first, cutting overdraw at little cost in cache misses
+// - vertices are laid out in the order the triangles first use them, and the
+//   unreferenced ones dropped
+// - meshlets are optionally rebuilt on the new order
+// The cache is modeled as a FIFO, and every step is deterministic.
+
+#include "vk_engine/vk_engine.hpp"
+
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+struct CacheStats
+{
+  // Average cache miss ratio, vertices shaded per triangle. 0.5 at best for
+  // a regular grid, 3 at worst
+  float acmr;
+  // Average transformed vertex ratio, vertices shaded per vertex referenced.
+  // 1 at best
+  float atvr;
+};
+
+// Timestamps of a FIFO cache. A vertex is cached when fewer than cache_size
+// vertices were added after it
+class VertexCache
+{
+  std::vector<uint32_t> m_time;
+  uint32_t m_size;
+  uint32_t m_timestamp;
+
+ public:
+  VertexCache(std::size_t vertex_count, uint32_t size)
+      : m_time(vertex_count, 0)
+      , m_size{size}
+      , m_timestamp{size + 1}
+  {
+  }
+
+  bool contains(uint32_t vertex) const
+  {
+    return m_timestamp - m_time[vertex] <= m_size;
+  }
+
+  // Age of a cached vertex, 1 for the newest
+  uint32_t age(uint32_t vertex) const
+  {
+    return m_timestamp - m_time[vertex];
+  }
+
+  // True on a miss
+  bool access(uint32_t vertex)
+  {
+    if (contains(vertex)) {
+      return false;
+    }
+    m_time[vertex] = m_timestamp++;
+    return true;
+  }
+
+  uint32_t access_triangle(uint32_t const* triangle)
+  {
+    return access(triangle[0]) + access(triangle[1]) + access(triangle[2]);
+  }
+
+  void flush()
+  {
+    m_timestamp += m_size + 1;
+  }
+
+  uint32_t size() const
+  {
+    return m_size;
+  }
+};
+
+CacheStats analyze_vertex_cache(std::span<uint32_t const> indices,
+                                std::size_t vertex_count, uint32_t cache_size)
+{
+  VertexCache cache{vertex_count, cache_size};
+  std::vector<bool> referenced(vertex_count, false);
+  uint32_t misses = 0, unique = 0;
+  for (auto index : indices) {
+    misses += cache.access(index);
+    if (!referenced[index]) {
+      referenced[index] = true;
+      ++unique;
+    }
+  }
+  const auto triangle_count = static_cast<float>(indices.size() / 3);
+  return {triangle_count > 0 ? misses / triangle_count : 0.f,
+          unique > 0 ? static_cast<float>(misses) / unique : 0.f};
+}
+
+// Tipsify: emit every triangle around a fanning vertex, then move to the
+// adjacent vertex staying longest in the cache once its own triangles are
+// emitted. clusters receives the first triangle of every run started away
+// from the previous triangles, where the order can change for free
+std::vector<uint32_t> optimize_vertex_cache(std::span<uint32_t const> indices,
+                                            std::size_t vertex_count,
+                                            uint32_t cache_size,
+                                            std::vector<uint32_t>& clusters)
+{
+  const std::size_t triangle_count = indices.size() / 3;
+  // Triangles around each vertex, and how many are left to emit
+  std::vector<uint32_t> live(vertex_count, 0);
+  for (auto index : indices) {
+    ++live[index];
+  }
+  std::vector<uint32_t> offsets(vertex_count + 1, 0);
+  std::partial_sum(live.begin(), live.end(), offsets.begin() + 1);
+  std::vector<uint32_t> adjacency(indices.size());
+  {
+    auto fill = offsets;
+    for (std::size_t i = 0; i < indices.size(); ++i) {
+      adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+    }
+  }
+
+  VertexCache cache{vertex_count, cache_size};
+  std::vector<bool> emitted(triangle_count, false);
+  std::vector<uint32_t> dead_ends;
+  std::vector<uint32_t> candidates;
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  clusters.clear();
+
+  uint32_t cursor     = 0;
+  auto next_in_memory = [&] {
+    while (cursor < vertex_count && live[cursor] == 0) {
+      ++cursor;
+    }
+    if (cursor == vertex_count) {
+      return ~0u;
+    }
+    clusters.push_back(static_cast<uint32_t>(result.size() / 3));
+    return cursor;
+  };
+
+  uint32_t fanning = next_in_memory();
+  while (fanning != ~0u) {
+    candidates.clear();
+    for (uint32_t i = offsets[fanning]; i < offsets[fanning + 1]; ++i) {
+      const uint32_t triangle = adjacency[i];
+      if (emitted[triangle]) {
+        continue;
+      }
+      emitted[triangle] = true;
+      for (uint32_t corner = 0; corner < 3; ++corner) {
+        const uint32_t vertex = indices[triangle * 3 + corner];
+        result.push_back(vertex);
+        dead_ends.push_back(vertex);
+        candidates.push_back(vertex);
+        --live[vertex];
+        cache.access(vertex);
+      }
+    }
+
+    // The candidate still cached after fanning, which adds at most two
+    // vertices per triangle, and oldest otherwise. Any live one will do
+    uint32_t next      = ~0u;
+    int64_t best_score = -1;
+    for (auto vertex : candidates) {
+      if (live[vertex] == 0) {
+        continue;
+      }
+      int64_t score = 0;
+      if (cache.contains(vertex)
+          && cache.age(vertex) + 2 * live[vertex] <= cache.size()) {
+        score = cache.age(vertex);
+      }
+      if (score > best_score) {
+        best_score = score;
+        next       = vertex;
+      }
+    }
+    // Dead end, back to the most recent vertex with triangles left
+    while (next == ~0u && !dead_ends.empty()) {
+      const uint32_t vertex = dead_ends.back();
+      dead_ends.pop_back();
+      if (live[vertex] > 0) {
+        next = vertex;
+      }
+    }
+    if (next == ~0u) {
+      next = next_in_memory();
+    }
+    fanning = next;
+  }
+  return result;
+}
+
+// Split the clusters further wherever the triangles emitted since the last
+// split miss the cache no more than threshold times the cluster average, then
+// draw the clusters facing away from the center of the mesh first. Those
+// tend to occlude the others, which then fail the depth test
+std::vector<uint32_t> optimize_overdraw(std::span<uint32_t const> indices,
+                                        std::span<glm::vec3 const> positions,
+                                        std::span<uint32_t const> clusters,
+                                        uint32_t cache_size, float threshold)
+{
+  const auto triangle_count = static_cast<uint32_t>(indices.size() / 3);
+  VertexCache cache{positions.size(), cache_size};
+  std::vector<uint32_t> splits;
+  for (std::size_t c = 0; c < clusters.size(); ++c) {
+    const uint32_t begin = clusters[c];
+    const uint32_t end =
+        c + 1 < clusters.size() ? clusters[c + 1] : triangle_count;
+    cache.flush();
+    uint32_t misses = 0;
+    for (uint32_t t = begin; t < end; ++t) {
+      misses += cache.access_triangle(&indices[t * 3]);
+    }
+    const float limit = threshold * misses / (end - begin);
+
+    cache.flush();
+    splits.push_back(begin);
+    uint32_t split_misses = 0;
+    for (uint32_t t = begin; t + 1 < end; ++t) {
+      split_misses += cache.access_triangle(&indices[t * 3]);
+      if (split_misses <= limit * (t + 1 - splits.back())) {
+        splits.push_back(t + 1);
+        split_misses = 0;
+        cache.flush();
+      }
+    }
+  }
+
+  // Area weighted centroids and normals
+  struct Cluster
+  {
+    uint32_t begin;
+    uint32_t end;
+    glm::vec3 centroid{0.f};
+    glm::vec3 normal{0.f};
+    float area{0.f};
+    float sort_key{0.f};
+  };
+  std::vector<Cluster> sorted;
+  glm::vec3 mesh_centroid{0.f};
+  float mesh_area = 0.f;
+  for (std::size_t s = 0; s < splits.size(); ++s) {
+    Cluster cluster{splits[s],
+                    s + 1 < splits.size() ? splits[s + 1] : triangle_count};
+    for (uint32_t t = cluster.begin; t < cluster.end; ++t) {
+      auto const& a    = positions[indices[t * 3]];
+      auto const& b    = positions[indices[t * 3 + 1]];
+      auto const& c    = positions[indices[t * 3 + 2]];
+      glm::vec3 normal = glm::cross(b - a, c - a);
+      float area       = glm::length(normal);
+      cluster.centroid += (a + b + c) * (area / 3.f);
+      cluster.normal += normal;
+      cluster.area += area;
+    }
+    mesh_centroid += cluster.centroid;
+    mesh_area += cluster.area;
+    if (cluster.area > 0.f) {
+      cluster.centroid = cluster.centroid / cluster.area;
+    }
+    sorted.push_back(cluster);
+  }
+  if (mesh_area > 0.f) {
+    mesh_centroid = mesh_centroid / mesh_area;
+  }
+  for (auto& cluster : sorted) {
+    float length = glm::length(cluster.normal);
+    cluster.sort_key =
+        length > 0.f
+            ? glm::dot(cluster.centroid - mesh_centroid, cluster.normal / length)
+            : 0.f;
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](Cluster const& a, Cluster const& b) {
+                     return a.sort_key > b.sort_key;
+                   });
+
+  std::vector<uint32_t> result;
+  result.reserve(indices.size());
+  for (auto const& cluster : sorted) {
+    result.insert(result.end(), indices.begin() + cluster.begin * 3,
+                  indices.begin() + cluster.end * 3);
+  }
+  return result;
+}
+
+// Lay the vertices out in first use order, dropping the unreferenced ones,
+// so the vertex fetch walks the buffer forward. Remaps the indices and
+// returns the previous index of every vertex
+std::vector<uint32_t> optimize_vertex_fetch(std::vector<uint32_t>& indices,
+                                            std::size_t vertex_count)
+{
+  std::vector<uint32_t> remap(vertex_count, ~0u);
+  std::vector<uint32_t> order;
+  for (auto& index : indices) {
+    if (remap[index] == ~0u) {
+      remap[index] = static_cast<uint32_t>(order.size());
+      order.push_back(index);
+    }
+    index = remap[index];
+  }
+  return order;
+}
+
+template<typename T>
+std::vector<T> reorder(std::span<T const> values,
+                       std::span<uint32_t const> order)
+{
+  std::vector<T> result;
+  result.reserve(order.size());
+  for (auto index : order) {
+    result.push_back(values[index]);
+  }
+  return result;
+}
+
+void print_stats(char const* label, CacheStats stats)
+{
+  std::cerr << label << "ACMR " << stats.acmr << ", ATVR " << stats.atvr
+            << '\n';
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+  uint32_t cache_size = 16;
+  float threshold     = 1.05f;
+  bool overdraw       = true;
+  bool meshlets       = false;
+  char const* input   = nullptr;
+  char const* output  = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    std::string_view arg{argv[i]};
+    if (arg == "--cache-size" && i + 1 < argc) {
+      cache_size = std::max(std::atoi(argv[++i]), 3);
+    } else if (arg == "--overdraw-threshold" && i + 1 < argc) {
+      threshold = std::max(std::strtof(argv[++i], nullptr), 1.f);
+    } else if (arg == "--no-overdraw") {
+      overdraw = false;
+    } else if (arg == "--meshlets") {
+      meshlets = true;
+    } else if (input == nullptr && arg.substr(0, 2) != "--") {
+      input = argv[i];
+    } else if (output == nullptr && arg.substr(0, 2) != "--") {
+      output = argv[i];
+    } else {
+      input = nullptr;
+      break;
+    }
+  }
+  if (input == nullptr || output == nullptr) {
+    std::cerr << "usage: " << argv[0]
+              << " [--cache-size N] [--overdraw-threshold F] [--no-overdraw]"
+                 " [--meshlets] input.vmesh output.vmesh\n";
+    return 1;
+  }
+
+  MeshFile file;
+  if (!file.open(input)) {
+    return 1;
+  }
+  auto const& header = file.header();
+  std::vector<PackedVertex> vertices(header.vertex_count);
+  std::memcpy(vertices.data(), file.vertices().data(), file.vertices().size());
+  std::vector<uint32_t> indices(header.index_count);
+  for (uint32_t i = 0; i < header.index_count; ++i) {
+    if (header.index_size == sizeof(uint16_t)) {
+      uint16_t index;
+      std::memcpy(&index, file.indices().data() + i * sizeof(index),
+                  sizeof(index));
+      indices[i] = index;
+    } else {
+      std::memcpy(&indices[i], file.indices().data() + i * sizeof(uint32_t),
+                  sizeof(uint32_t));
+    }
+  }
+  indices.resize(indices.size() / 3 * 3);
+  for (auto index : indices) {
+    if (index >= vertices.size()) {
+      std::cerr << input << ": index " << index << " out of "
+                << vertices.size() << " vertices\n";
+      return 1;
+    }
+  }
+  std::vector<glm::vec3> positions;
+  positions.reserve(vertices.size());
+  for (auto const& vertex : vertices) {
+    uint64_t half_position;
+    std::memcpy(&half_position, vertex.position, sizeof(half_position));
+    positions.emplace_back(glm::unpackHalf4x16(half_position));
+  }
+
+  std::cerr << input << ": " << vertices.size() << " vertices, "
+            << indices.size() / 3 << " triangles, FIFO cache of "
+            << cache_size << '\n';
+  print_stats("  before: ",
+              analyze_vertex_cache(indices, vertices.size(), cache_size));
+
+  std::vector<uint32_t> clusters;
+  indices =
+      optimize_vertex_cache(indices, vertices.size(), cache_size, clusters);
+  print_stats("  vertex cache: ",
+              analyze_vertex_cache(indices, vertices.size(), cache_size));
+  if (overdraw) {
+    indices = optimize_overdraw(indices, positions, clusters, cache_size,
+                                threshold);
+    print_stats("  overdraw: ",
+                analyze_vertex_cache(indices, vertices.size(), cache_size));
+  }
+  auto order = optimize_vertex_fetch(indices, vertices.size());
+  vertices   = reorder<PackedVertex>(vertices, order);
+  positions  = reorder<glm::vec3>(positions, order);
+  std::cerr << "  vertex fetch: " << vertices.size() << " vertices\n";
+
+  // The old meshlets no longer match the triangle order
+  std::vector<MeshletBounds> meshlet_bounds;
+  if (meshlets) {
+    meshlet_bounds = build_meshlets(positions, indices);
+    std::cerr << "  " << meshlet_bounds.size() << " meshlets\n";
+  } else if (header.meshlet_count != 0) {
+    std::cerr << "  meshlets dropped, rebuild them with --meshlets\n";
+  }
+
+  std::vector<uint16_t> short_indices;
+  MeshFileData data{};
+  data.vertices = vertices;
+  data.meshlets = meshlet_bounds;
+  std::memcpy(data.bounds, header.bounds, sizeof(data.bounds));
+  if (vertices.size() <= 0x10000) {
+    short_indices.assign(indices.begin(), indices.end());
+    data.indices    = std::as_bytes(std::span{short_indices});
+    data.index_size = sizeof(uint16_t);
+  } else {
+    data.indices    = std::as_bytes(std::span{indices});
+    data.index_size = sizeof(uint32_t);
+  }
+  return write_mesh_file(output, data) ? 0 : 1;
+}